@@ -0,0 +1,26 @@
+// Verified with -allow_should_fail -max_steps_per_function 1000. The budget of slow is exceeded while the
+// assumptions of its precondition are active; these must not leak into the verification of later.
+
+//@ fixpoint int f(int x);
+
+void slow(int a, int b, int c, int d, int e, int g, int h, int i)
+    //@ requires f(0) == 1 &*& f(1) == 1 &*& f(2) == 1 &*& f(3) == 1;
+    //@ ensures true;
+{
+    // 2^8 paths
+    if (a < 0) a = 0;
+    if (b < 0) b = 0;
+    if (c < 0) c = 0;
+    if (d < 0) d = 0;
+    if (e < 0) e = 0;
+    if (g < 0) g = 0;
+    if (h < 0) h = 0;
+    if (i < 0) i = 0;
+}
+
+void later()
+    //@ requires true;
+    //@ ensures true;
+{
+    //@ assert f(0) == 1; //~ should_fail
+}
@@ -0,0 +1,30 @@
+// The weakened version of incremental_auto_lemma.c; m does not verify.
+
+/*@
+inductive ints = ints_nil | ints_cons(int, ints);
+
+fixpoint int ints_length(ints is) {
+  switch(is) {
+    case ints_nil: return 0;
+    case ints_cons(h, t): return 1 + ints_length(t);
+  }
+}
+
+lemma_auto void ints_length_nonnegative(ints is)
+  requires true;
+  ensures true;
+{
+  switch(is) {
+    case ints_nil: ;
+    case ints_cons(h, t): ints_length_nonnegative(t);
+  }
+}
+
+predicate p(ints is) = true;
+@*/
+
+void m()
+  //@ requires p(?is);
+  //@ ensures p(is) &*& 0 <= ints_length(is);
+{
+}
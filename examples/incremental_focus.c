@@ -0,0 +1,14 @@
+// Verified twice with -incremental by the test suite: first with -focus on good, then without -focus.
+// bad was not verified by the first run, so it must not be cached and the second run must fail.
+
+void good()
+  //@ requires true;
+  //@ ensures true;
+{
+}
+
+void bad()
+  //@ requires true;
+  //@ ensures false;
+{
+}
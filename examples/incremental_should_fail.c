@@ -0,0 +1,15 @@
+// Verified twice with -incremental -allow_should_fail by the test suite. m consumes the should-fail directive,
+// so it must not be cached: otherwise, the second run would skip m and report that no error was found.
+
+void m()
+  //@ requires true;
+  //@ ensures true;
+{
+  //@ assert false; //~ should_fail
+}
+
+void n()
+  //@ requires true;
+  //@ ensures true;
+{
+}
@@ -0,0 +1,94 @@
+# Link phase benchmark.
+#
+# Generates a program consisting of N modules (default 500), verifies each module
+# separately with -emit_vfmanifest, and then times the link phase, which matches
+# the functions, structures and predicates that each module requires and provides
+# across all modules' manifests.
+#
+# Module i declares, in mod_i.h, a struct, a predicate, and a function; mod_i.c
+# gives the struct and the predicate a body, and implements the function by
+# calling the function of module i - 1.
+#
+# Usage: python3 link_benchmark.py [-n N] [-verifast path/to/verifast] [-keep]
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+def generate(dir, n):
+    for i in range(n):
+        with open(os.path.join(dir, 'mod_%d.h' % i), 'w') as f:
+            f.write('''#ifndef MOD_{i}_H
+#define MOD_{i}_H
+
+struct s_{i};
+
+//@ predicate p_{i}(struct s_{i} *s);
+
+int f_{i}(struct s_{i} *s);
+  //@ requires p_{i}(s);
+  //@ ensures p_{i}(s);
+
+#endif
+'''.format(i=i))
+        with open(os.path.join(dir, 'mod_%d.c' % i), 'w') as f:
+            f.write('#include "mod_{i}.h"\n'.format(i=i))
+            if i > 0:
+                f.write('#include "mod_{j}.h"\n'.format(j=i - 1))
+            f.write('''
+struct s_{i} {{
+  int value;
+}};
+
+//@ predicate p_{i}(struct s_{i} *s) = s->value |-> _;
+
+int f_{i}(struct s_{i} *s)
+  //@ requires p_{i}(s);
+  //@ ensures p_{i}(s);
+{{
+  //@ open p_{i}(s);
+  int result = s->value;
+  //@ close p_{i}(s);
+  return result;
+}}
+'''.format(i=i))
+            if i > 0:
+                f.write('''
+int g_{i}(struct s_{j} *s)
+  //@ requires p_{j}(s);
+  //@ ensures p_{j}(s);
+{{
+  return f_{j}(s);
+}}
+'''.format(i=i, j=i - 1))
+
+def main():
+    parser = argparse.ArgumentParser(description='VeriFast link phase benchmark')
+    parser.add_argument('-n', type=int, default=500, help='number of modules')
+    parser.add_argument('-verifast', default='verifast', help='path to the verifast executable')
+    parser.add_argument('-keep', action='store_true', help='keep the generated files')
+    args = parser.parse_args()
+
+    dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'generated')
+    if os.path.exists(dir):
+        shutil.rmtree(dir)
+    os.makedirs(dir)
+    try:
+        generate(dir, args.n)
+        start = time.time()
+        for i in range(args.n):
+            subprocess.run([args.verifast, '-c', '-emit_vfmanifest', 'mod_%d.c' % i], cwd=dir, check=True, stdout=subprocess.DEVNULL)
+        print('Verified %d modules in %.2fs' % (args.n, time.time() - start))
+        objects = ['mod_%d.o' % i for i in range(args.n)]
+        start = time.time()
+        subprocess.run([args.verifast, '-shared'] + objects, cwd=dir, check=True, stdout=subprocess.DEVNULL)
+        print('Linked %d modules in %.2fs' % (args.n, time.time() - start))
+    finally:
+        if not args.keep:
+            shutil.rmtree(dir)
+
+if __name__ == '__main__':
+    sys.exit(main())
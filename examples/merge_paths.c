@@ -0,0 +1,31 @@
+// Verified with and without -merge_paths. Without it, the return statement is verified on 2^3 paths;
+// with it, the three conditional statements are merged at their join points and it is verified once.
+
+int abs_sum(int x, int y, int z)
+    //@ requires -1000 <= x &*& x <= 1000 &*& -1000 <= y &*& y <= 1000 &*& -1000 <= z &*& z <= 1000;
+    //@ ensures 0 <= result &*& result <= 3000;
+{
+    if (x < 0) x = 0 - x;
+    if (y < 0) y = 0 - y;
+    if (z < 0) z = 0 - z;
+    return x + y + z;
+}
+
+// The bounds of a & b are known only through facts assumed when evaluating the bitwise operator,
+// so this conditional statement is not merged.
+int and_or_zero(unsigned char a, unsigned char b, int c)
+    //@ requires true;
+    //@ ensures 0 <= result &*& result <= 255;
+{
+    int r = 0;
+    if (c != 0) r = a & b;
+    return r;
+}
+
+int main()
+    //@ requires true;
+    //@ ensures true;
+{
+    int s = abs_sum(-1, 2, -3);
+    return 0;
+}
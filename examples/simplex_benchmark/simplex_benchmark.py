@@ -0,0 +1,65 @@
+# Simplex benchmark.
+#
+# Verifies a number of arithmetic-heavy examples with the Redux prover and -stats,
+# and reports, for each example, the best wall-clock time and the best time spent
+# in Redux's Simplex tableau over a number of runs. If -baseline is given, the
+# examples are verified with both executables and the speedup is reported, e.g. to
+# compare a build of this tree against a build of an earlier commit.
+#
+# Usage: python3 simplex_benchmark.py [-verifast path/to/verifast] [-baseline path/to/verifast] [-runs N]
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+examples = [
+    ['-c', 'leftpad.c'],
+    ['-shared', 'insertion_sort.c'],
+    ['-c', 'mergesort_and_binarysearch.c'],
+    ['-read_options_from_source_file', 'priorityqueue-forall_nth.c'],
+    ['sprintf.c'],
+    ['-disable_overflow_check', 'wc.c'],
+]
+
+simplex_time_regex = re.compile(r'^Time spent in Simplex: ([0-9.]+)s', re.MULTILINE)
+
+def run(verifast, args, dir):
+    start = time.time()
+    result = subprocess.run([verifast, '-prover', 'redux', '-stats'] + args, cwd=dir, check=True, stdout=subprocess.PIPE, universal_newlines=True)
+    elapsed = time.time() - start
+    match = simplex_time_regex.search(result.stdout)
+    return elapsed, float(match.group(1)) if match else 0.0
+
+def measure(verifast, args, dir, runs):
+    results = [run(verifast, args, dir) for _ in range(runs)]
+    return min(elapsed for elapsed, _ in results), min(simplex for _, simplex in results)
+
+def main():
+    parser = argparse.ArgumentParser(description='VeriFast Simplex benchmark')
+    parser.add_argument('-verifast', default='verifast', help='path to the verifast executable')
+    parser.add_argument('-baseline', help='path to a verifast executable to compare against')
+    parser.add_argument('-runs', type=int, default=3, help='number of runs per example')
+    args = parser.parse_args()
+
+    dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    totals = [0.0, 0.0, 0.0, 0.0]
+    for example in examples:
+        elapsed, simplex = measure(args.verifast, example, dir, args.runs)
+        totals[0] += elapsed
+        totals[1] += simplex
+        line = '%-32s total %7.3fs  simplex %7.3fs' % (example[-1], elapsed, simplex)
+        if args.baseline:
+            base_elapsed, base_simplex = measure(args.baseline, example, dir, args.runs)
+            totals[2] += base_elapsed
+            totals[3] += base_simplex
+            line += '  (baseline: total %7.3fs  simplex %7.3fs)' % (base_elapsed, base_simplex)
+        print(line)
+    print('%-32s total %7.3fs  simplex %7.3fs' % ('all examples', totals[0], totals[1]))
+    if args.baseline and totals[1] > 0:
+        print('Speedup: total %.2fx  simplex %.2fx' % (totals[2] / totals[0], totals[3] / totals[1]))
+
+if __name__ == '__main__':
+    sys.exit(main())
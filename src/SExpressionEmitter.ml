@@ -1174,8 +1174,21 @@ let sexpr_of_package (PackageDecl (loc, name, imports, declarations)) : sexpress
                                in
                                sexpr_of_list ~head:head sexpr_of_decl declarations ]
 
-let with_open_file (filename : string) (func : out_channel -> unit) : unit =
-  let channel = open_out filename in
+(*
+  Same as sexpr_of_package, except that each declaration is converted as it is written
+*)
+let streamed_sexpr_of_package (PackageDecl (loc, name, imports, declarations)) : streamed_sexpression =
+  StreamedList ([ Sexpr (Symbol "declare-package")
+                ; Sexpr (Symbol name)
+                ; Sexpr (Keyword "imports")
+                ; Sexpr (sexpr_of_list sexpr_of_import imports)
+                ; Sexpr (Keyword "declarations")
+                ; StreamedList ([ Sexpr (Symbol "declarations") ],
+                                Seq.map sexpr_of_decl (List.to_seq declarations)) ],
+                Seq.empty)
+
+let with_open_file ?(binary = false) (filename : string) (func : out_channel -> unit) : unit =
+  let channel = if binary then open_out_bin filename else open_out filename in
   try
     func channel;
     close_out channel
@@ -1185,13 +1198,21 @@ let with_open_file (filename : string) (func : out_channel -> unit) : unit =
         raise e
       end
 
-let emit ?(margin = 160) (target_file : string) (packages : package list) : unit =
+let emit ?(margin = 160) ?(binary = false) (target_file : string) (packages : package list) : unit =
   let emit_to channel =
-    let output_string = output_string channel
-    in
-    packages |> List.iter begin fun p ->
-      output_string (string_of_sexpression $. sexpr_of_package p);
-      output_string "\n"
+    if binary then begin
+      output_string channel binary_format_header;
+      packages |> List.iter begin fun p ->
+        output_binary_streamed_sexpression channel (streamed_sexpr_of_package p)
+      end
+    end else begin
+      let formatter = Format.formatter_of_out_channel channel
+      in
+      Format.pp_set_margin formatter margin;
+      packages |> List.iter begin fun p ->
+        format_streamed_sexpression formatter (streamed_sexpr_of_package p);
+        output_string channel "\n"
+      end
     end
   in
-  with_open_file target_file emit_to
+  with_open_file ~binary target_file emit_to
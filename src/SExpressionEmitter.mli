@@ -1,6 +1,11 @@
 val unsupported_exception : bool ref
 
-val emit : ?margin:int -> string -> Ast.package list -> unit
+(*
+  Writes the packages to the specified file, one s-expression per package, either
+  as text or (if binary is true) in the binary format of SExpressions. Declarations
+  are converted as they are written.
+*)
+val emit : ?margin:int -> ?binary:bool -> string -> Ast.package list -> unit
 
 
 (*
@@ -7,6 +7,10 @@ type sexpression =
   | Keyword of string
   | Number of big_int
 
+type streamed_sexpression =
+  | Sexpr of sexpression
+  | StreamedList of streamed_sexpression list * sexpression Seq.t
+
 type argument_group =
   | Single of sexpression
   | KeywordPair of string * sexpression
@@ -38,7 +42,42 @@ let destructure sexpressions : sexpression list * (sexpression * sexpression) li
   in
   group_args [] sexpressions
 
-let format_sexpression formatter sexpr =
+let is_keyword = function
+  | Sexpr (Keyword _) -> true
+  | _                 -> false
+
+(*
+  Same as destructure, for the elements of a list that are all in memory
+*)
+let destructure_nodes nodes : streamed_sexpression list * (streamed_sexpression * streamed_sexpression) list =
+  let rec group_kw_args args acc nodes =
+    match nodes with
+      | []                  -> (args, List.rev acc)
+      | (kw :: v :: nodes) when is_keyword kw -> group_kw_args args ((kw, v) :: acc) nodes
+      | _                   -> failwith "Invalid s-expression"
+  in
+  let rec group_args acc nodes =
+    match nodes with
+      | []                          -> (List.rev acc, [])
+      | (kw :: _) when is_keyword kw -> group_kw_args (List.rev acc) [] nodes
+      | (node :: nodes)             -> group_args (node :: acc) nodes
+  in
+  group_args [] nodes
+
+(*
+  Returns the first n elements of seq (or fewer, if seq is shorter), as well as the remaining elements.
+  The elements are computed only once.
+*)
+let rec peek n (seq : 'a Seq.t) : 'a list * 'a Seq.t =
+  if n = 0 then ([], seq) else
+  match seq () with
+    | Seq.Nil          -> ([], fun () -> Seq.Nil)
+    | Seq.Cons (x, xs) ->
+      let (prefix, rest) = peek (n - 1) xs
+      in
+      (x :: prefix, rest)
+
+let format_streamed_sexpression formatter sexpr =
   let box ?(indent = 0) (contents : unit -> unit) () : unit =
     pp_open_box formatter indent;
     contents ();
@@ -79,14 +118,13 @@ let format_sexpression formatter sexpr =
   let nop () =
     ()
   in
-  let separate_by_spaces xs () : unit =
-    let separate xs =
-      List.iter (fun x -> seq [ space; x ] ()) xs
-    in
-    match xs with
-      | []      -> ()
-      | [x]     -> x ()
-      | (x::xs) -> x (); separate xs
+  let separate_seq_by_spaces (xs : (unit -> unit) Seq.t) () : unit =
+    match xs () with
+      | Seq.Nil          -> ()
+      | Seq.Cons (x, xs) -> x (); Seq.iter (fun x -> seq [ space; x ] ()) xs
+  in
+  let separate_by_spaces xs =
+    separate_seq_by_spaces (List.to_seq xs)
   in
   let rec format sexpr : unit -> unit =
     match sexpr with
@@ -96,29 +134,62 @@ let format_sexpression formatter sexpr =
         else verbatim str
       | Keyword str -> verbatim $ ":" ^ str
       | Number n    -> verbatim $ string_of_big_int n
-      | List xs     ->
+      | List xs     -> format_list (List.map (fun x -> Sexpr x) xs) Seq.empty
+  and format_node node : unit -> unit =
+    match node with
+      | Sexpr sexpr              -> format sexpr
+      | StreamedList (xs, tail) -> format_list xs tail
+  (*
+     Formats the list whose elements are xs followed by tail. If tail is not empty,
+     the list must not contain keywords; its elements are then formatted as they are
+     produced.
+  *)
+  and format_list xs tail : unit -> unit =
+    let (tail_prefix, tail_rest) = peek (max 0 (3 - List.length xs)) tail
+    in
+    let xs = xs @ List.map (fun x -> Sexpr x) tail_prefix
+    in
+    if tail_prefix <> [] && List.length xs >= 3 then
+      (*
+         As below, for a list without keywords, except that the elements are
+         formatted as they are produced
+      *)
+      let (x, xs) = (List.hd xs, List.tl xs)
+      in
+      let node_of_tail_element = function
+        | Keyword _ -> failwith "Invalid s-expression: keyword in streamed list"
+        | sexpr     -> Sexpr sexpr
+      in
+      if List.exists is_keyword xs then failwith "Invalid s-expression: keyword in streamed list";
+      let args = Seq.append (List.to_seq xs) (Seq.map node_of_tail_element tail_rest)
+      in
+      hbox $ seq [ verbatim "("
+                 ; hvbox ~indent:2 $ separate_by_spaces [ format_node x
+                                                        ; hovbox $ separate_seq_by_spaces (Seq.map format_node args) ]
+                 ; verbatim ")" ]
+    else
         match xs with
-          | [ Symbol "quote"; quoted ] -> hbox $ seq [ verbatim "'"
-                                                     ; format quoted ]
+          | [ Sexpr (Symbol "quote"); quoted ] -> hbox $ seq [ verbatim "'"
+                                                             ; format_node quoted ]
           | _ ->
             hbox $ seq [ verbatim "("
                        ; begin
                          match xs with
                            | []        -> nop
-                           | [x]       -> box $ format x
-                           | [x; y]    -> hvbox $ seq [ format x
+                           | [x]       -> box $ format_node x
+                           | [x; y]    -> hvbox $ seq [ format_node x
                                                       ; break 1 2
-                                                      ; format y ]
+                                                      ; format_node y ]
                            | (x :: xs) ->
-                             let (args, kw_args) = destructure xs
+                             let (args, kw_args) = destructure_nodes xs
                              in
                              let args' =
-                               hovbox $ separate_by_spaces (List.map format args)
+                               hovbox $ separate_by_spaces (List.map format_node args)
                              in
                              let kw_args' =
                                let format_pair (kw, sexpr) =
-                                 hbox $ separate_by_spaces [ format kw
-                                                           ; format sexpr ]
+                                 hbox $ separate_by_spaces [ format_node kw
+                                                           ; format_node sexpr ]
                                in
                                vbox $ separate_by_spaces (List.map format_pair kw_args)
                              in
@@ -127,7 +198,7 @@ let format_sexpression formatter sexpr =
                              in
                              let sexprs =
                                List.concat
-                                 [ [ format x ]
+                                 [ [ format_node x ]
                                  ; if is_empty args
                                    then []
                                    else [ args' ]
@@ -139,12 +210,88 @@ let format_sexpression formatter sexpr =
                          end
                        ; verbatim ")" ]
   in
-  format sexpr ();
+  format_node sexpr ();
   flush ()
 
+let format_sexpression formatter sexpr =
+  format_streamed_sexpression formatter (Sexpr sexpr)
+
 let string_of_sexpression ?(margin = 160) sexpr =
   let buffer = Buffer.create 1024 in
   let formatter = formatter_of_buffer buffer in
   pp_set_margin formatter margin;
   format_sexpression formatter sexpr;
   Buffer.contents buffer
+
+(*
+  Binary format
+
+  An s-expression is written as a tag byte followed by its contents:
+    '(' elements ')'     list
+    'S' string           symbol
+    'K' string           keyword (without the leading colon)
+    'N' string           number, in decimal notation
+  A string is written as its length (unsigned LEB128) followed by its bytes.
+*)
+let binary_format_header = "VeriFast-sexpr-binary 1\n"
+
+let output_varint channel n =
+  let rec iter n =
+    if n < 0x80 then
+      output_byte channel n
+    else begin
+      output_byte channel (0x80 lor (n land 0x7f));
+      iter (n lsr 7)
+    end
+  in
+  iter n
+
+let output_binary_string channel str =
+  output_varint channel (String.length str);
+  output_string channel str
+
+let rec output_binary_streamed_sexpression channel sexpr =
+  let output_sexpr sexpr = output_binary_streamed_sexpression channel (Sexpr sexpr)
+  in
+  match sexpr with
+    | Sexpr (List xs)         -> output_char channel '('; List.iter output_sexpr xs; output_char channel ')'
+    | Sexpr (Symbol str)      -> output_char channel 'S'; output_binary_string channel str
+    | Sexpr (Keyword str)     -> output_char channel 'K'; output_binary_string channel str
+    | Sexpr (Number n)        -> output_char channel 'N'; output_binary_string channel (string_of_big_int n)
+    | StreamedList (xs, tail) ->
+      output_char channel '(';
+      List.iter (output_binary_streamed_sexpression channel) xs;
+      Seq.iter output_sexpr tail;
+      output_char channel ')'
+
+let output_binary_sexpression channel sexpr =
+  output_binary_streamed_sexpression channel (Sexpr sexpr)
+
+let input_varint channel =
+  let rec iter shift n =
+    let b = input_byte channel in
+    let n = n lor ((b land 0x7f) lsl shift) in
+    if b land 0x80 = 0 then n else iter (shift + 7) n
+  in
+  iter 0 0
+
+let input_binary_string channel =
+  let length = input_varint channel in
+  really_input_string channel length
+
+let input_binary_sexpression channel =
+  let rec sexpr_of_tag tag =
+    match tag with
+      | '(' ->
+        let rec elements acc =
+          match input_char channel with
+            | ')' -> List (List.rev acc)
+            | tag -> elements (sexpr_of_tag tag :: acc)
+        in
+        elements []
+      | 'S' -> Symbol (input_binary_string channel)
+      | 'K' -> Keyword (input_binary_string channel)
+      | 'N' -> Number (big_int_of_string (input_binary_string channel))
+      | _   -> failwith "Invalid binary s-expression"
+  in
+  sexpr_of_tag (input_char channel)
@@ -7,6 +7,31 @@ type sexpression =
   | Keyword of string
   | Number of big_int
 
+(*
+  An s-expression some of whose lists end with elements that are produced on demand,
+  so that it can be written without first being built in memory in its entirety.
+  A list with a non-empty tail of streamed elements must not contain keywords.
+*)
+type streamed_sexpression =
+  | Sexpr of sexpression
+  | StreamedList of streamed_sexpression list * sexpression Seq.t
+
 val format_sexpression : Format.formatter -> sexpression -> unit
 
+(*
+  Produces the same output as format_sexpression for the corresponding sexpression
+*)
+val format_streamed_sexpression : Format.formatter -> streamed_sexpression -> unit
+
 val string_of_sexpression : ?margin:int -> sexpression -> string
+
+(*
+  Compact binary format; see SExpressions.ml
+*)
+val binary_format_header : string
+
+val output_binary_sexpression : out_channel -> sexpression -> unit
+
+val output_binary_streamed_sexpression : out_channel -> streamed_sexpression -> unit
+
+val input_binary_sexpression : in_channel -> sexpression
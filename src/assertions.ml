@@ -57,20 +57,20 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   and branch cont1 cont2 =
     !stats#branch;
+    Profiler.branch ();
     let oldForest = !currentForest in
-    let leftForest = ref [] in
-    let rightForest = ref [] in
-    oldForest := Node (BranchNode, rightForest)::Node (BranchNode, leftForest)::!oldForest;
+    let leftForest = add_forest_node oldForest BranchNode in
+    let rightForest = add_forest_node oldForest BranchNode in
     currentForest := leftForest;
     push_context (Branching LeftBranch);
     execute_branch cont1;
     pop_context ();
-    if !leftForest = [] then leftForest := [Node (SuccessNode, ref [])];
+    if leftForest.childCount = 0 then ignore (add_forest_node leftForest SuccessNode);
     currentForest := rightForest;
     push_context (Branching RightBranch);
     execute_branch cont2;
     pop_context ();
-    if !rightForest = [] then rightForest := [Node (SuccessNode, ref [])];
+    if rightForest.childCount = 0 then ignore (add_forest_node rightForest SuccessNode);
     currentForest := oldForest;
     SymExecSuccess
   
@@ -734,6 +734,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           newChunks -- Any new chunks generated by this match; in particular, auto-splitting of fractional permissions.
    *)
   let match_chunk ghostenv h env env' l g targs coef coefpat inputParamCount pats tps0 tps (Chunk (g', targs0, coef0, ts0, size0) as chunk) cont =
+    Profiler.chunk_match ();
     let match_coef ghostenv env cont =
       if coef == real_unit && coefpat == real_unit_pat && coef0 == real_unit then cont chunk ghostenv env coef0 [] else
       let match_term_coefpat t =
@@ -1065,6 +1066,56 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     Printf.sprintf "%s%s%s(%s)" coef predname targs (String.concat ", " (List.map string_of_pat0 pats))
 
   let consume_chunk_recursion_depth = ref 0
+
+  (** An application of an automation rule (see consume_chunk_core) that failed, i.e. that called its continuation with None
+      without changing the prover state. Such an application fails again if the rule is applied to the same heap and arguments
+      in the same prover state, at the same or a greater recursion depth, as long as no predicate constructor applications
+      were added. Terms are compared physically, so a lookup never needs to consult the prover. *)
+  type 'rule failed_rule_application = {
+    failed_rule: 'rule;
+    failed_h: termnode heap;
+    failed_typeid_env: (string * termnode) list;
+    failed_targs: type_ list;
+    failed_terms_are_well_typed: bool;
+    failed_coef: termnode;
+    failed_coefpat: termnode pat0;
+    failed_ts: termnode list;
+    failed_depth: int;
+    failed_pred_ctor_applications: (termnode * (symbol * termnode * type_ list * termnode list * int option)) list
+  }
+
+  (** The failed rule applications recorded in the prover state with generation [fst !failed_rule_applications]. *)
+  let failed_rule_applications = ref (-1, [])
+
+  let max_failed_rule_applications = 256
+
+  let same_coefpat p1 p2 =
+    p1 == p2 || match p1, p2 with TermPat t1, TermPat t2 -> t1 == t2 | _ -> false
+
+  let rule_application_failed_before rule h typeid_env targs terms_are_well_typed coef coefpat ts =
+    let (generation, entries) = !failed_rule_applications in
+    generation = prover_state_generation () &&
+    let depth = !consume_chunk_recursion_depth in
+    let pred_ctor_applications = !pred_ctor_applications in
+    entries |> List.exists begin fun e ->
+      e.failed_rule == rule && e.failed_h == h && e.failed_typeid_env == typeid_env && e.failed_targs == targs &&
+      e.failed_terms_are_well_typed = terms_are_well_typed && e.failed_coef == coef && same_coefpat e.failed_coefpat coefpat &&
+      List.length e.failed_ts = List.length ts && List.for_all2 (==) e.failed_ts ts &&
+      e.failed_depth <= depth && e.failed_pred_ctor_applications == pred_ctor_applications
+    end
+
+  let record_failed_rule_application generation depth rule h typeid_env targs terms_are_well_typed coef coefpat ts =
+    let entries =
+      match !failed_rule_applications with
+        (generation', entries) when generation' = generation && List.length entries < max_failed_rule_applications -> entries
+      | _ -> []
+    in
+    let entry = {
+      failed_rule = rule; failed_h = h; failed_typeid_env = typeid_env; failed_targs = targs;
+      failed_terms_are_well_typed = terms_are_well_typed; failed_coef = coef; failed_coefpat = coefpat; failed_ts = ts;
+      failed_depth = depth; failed_pred_ctor_applications = !pred_ctor_applications
+    } in
+    failed_rule_applications := (generation, entry::entries)
   
   (** consume_chunk_core attempts to consume a chunk matching the specified predicate assertion from the specified heap.
       If no matching chunk is found in the heap, automation rules are tried (e.g. auto-open and auto-close rules).
@@ -1160,10 +1211,18 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                 let coefpat = match coefpat with SrcPat (LitPat e) -> TermPat (eval None env e) | _ -> coefpat in 
                 match rules with
                  [] -> cont ()
+                | rule::rules when rule_application_failed_before rule h typeid_env targs terms_are_well_typed coef coefpat ts ->
+                  !stats#failedRuleApplicationSkipped;
+                  iter rules
                 | rule::rules ->
-                  rule l h typeid_env targs terms_are_well_typed coef coefpat ts $. fun h ->
-                  match h with
-                    None -> iter rules
+                  let generation = prover_state_generation () in
+                  let depth = !consume_chunk_recursion_depth in
+                  rule l h typeid_env targs terms_are_well_typed coef coefpat ts $. fun h' ->
+                  match h' with
+                    None ->
+                    if prover_state_generation () = generation then
+                      record_failed_rule_application generation depth rule h typeid_env targs terms_are_well_typed coef coefpat ts;
+                    iter rules
                   | Some h ->
                     with_context (Executing (h, env, l, "Consuming chunk (retry)")) $. fun () ->
                     consume_chunk_core_core h
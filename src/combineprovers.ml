@@ -37,8 +37,19 @@ type combination_strategy =
                                    useful for comparing the provers *)
   | Sequence                    (* Run the second prover only if the
                                    first answers Unknown *)
+  | Race of float               (* Send each query to the second prover
+                                   asynchronously (see the start_query2
+                                   argument of combined_context), run
+                                   the first prover meanwhile, and wait
+                                   for the second prover, for at most
+                                   the given number of seconds, only if
+                                   the first answers Unknown. Assumptions
+                                   are checked by the first prover only.
+                                   A query is not sent to the second
+                                   prover while it is still busy with an
+                                   earlier query; this counts as a
+                                   timeout. *)
 (* other strategies of interest:
-     - run the provers in parallel (if one answers unsat, stop the other one)
      - run the provers in sequence but the first is stopped after a timeout *)
 
 (* In Ocaml, we cannot directly pass a polymorphic function as
@@ -50,8 +61,15 @@ type poly_map3 = {f : 'a 'b 'c. ('a, 'b, 'c) context -> 'c -> 'c -> 'c -> 'c}
 
 (* ['a, 'b, 'c, 'd, 'e, 'f] combined_context is an
    ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context *)
-class ['a, 'b, 'c, 'd, 'e, 'f] combined_context (p1 : ('a, 'b, 'c) context)
+class ['a, 'b, 'c, 'd, 'e, 'f] combined_context ?(start_query2 : ('f -> unit -> bool option) option)
+        (p1 : ('a, 'b, 'c) context)
         (p2: ('d, 'e, 'f) context) (combination_strategy : combination_strategy) =
+  (* For the Race strategy: the number of queries proved by the first prover, proved by the second
+     prover, not proved by either prover, and for which the second prover did not answer in time. *)
+  let race_p1_wins = ref 0 in
+  let race_p2_wins = ref 0 in
+  let race_unproved = ref 0 in
+  let race_timeouts = ref 0 in
   let map (r : poly_map) = function
     | Left x -> Left (r.f p1 x)
     | Right y -> Right (r.f p2 y)
@@ -172,6 +190,10 @@ object
            | Unsat ->
               p2#assert_term t2; Unsat
            end
+        | Race _ ->
+           let result = p1#assume t1 in
+           p2#assert_term t2;
+           result
       end
     | Left _ | Right _ -> failwith "Combineprovers.assume"
   method query = function
@@ -184,6 +206,22 @@ object
         | Sequence ->
            (* Remark: the "||" operator is lazy *)
            p1#query t1 || p2#query t2
+        | Race _ ->
+           let start_query2 =
+             match start_query2 with
+             | Some start_query2 -> start_query2
+             | None -> failwith "Combineprovers.query: the Race strategy requires the start_query2 argument"
+           in
+           let await2 = start_query2 t2 in
+           if p1#query t1 then begin
+             incr race_p1_wins;
+             true
+           end else begin
+             match await2 () with
+             | Some true -> incr race_p2_wins; true
+             | Some false -> incr race_unproved; false
+             | None -> incr race_timeouts; incr race_unproved; false
+           end
       end
     | Left _ | Right _ -> failwith "Combineprovers.query"
   method assert_term = function
@@ -204,7 +242,23 @@ object
       | (st1 :: l1, st2 :: l2) ->
          combine_stat st1 st2 :: combine_stats (l1, l2)
     in
-    (Printf.sprintf "<P1: %s, P2: %s>" s1 s2, combine_stats (l1, l2))
+    let race_stats =
+      match combination_strategy with
+      | Race _ ->
+         Printf.sprintf "\nRace: queries proved by P1: %d; by P2: %d; by neither: %d (P2 timeouts: %d)\n"
+           !race_p1_wins !race_p2_wins !race_unproved !race_timeouts
+      | Sync | Sequence -> ""
+    in
+    (Printf.sprintf "<P1: %s, P2: %s>%s" s1 s2 race_stats, combine_stats (l1, l2))
+  method counters =
+    let prefix p = List.map (fun (name, count) -> (p ^ name, count)) in
+    let race_counters =
+      match combination_strategy with
+      | Race _ ->
+         ["race_p1_wins", !race_p1_wins; "race_p2_wins", !race_p2_wins; "race_unproved", !race_unproved; "race_p2_timeouts", !race_timeouts]
+      | Sync | Sequence -> []
+    in
+    prefix "P1:" p1#counters @ prefix "P2:" p2#counters @ race_counters
   method begin_formal = p1#begin_formal; p2#begin_formal
   method end_formal = p1#end_formal; p2#end_formal
   method mk_bound i (ty1, ty2) = Both (p1#mk_bound i ty1, p2#mk_bound i ty2)
@@ -229,9 +283,10 @@ object
 end
 
 let combine
+      ?(start_query2 : ('f -> unit -> bool option) option)
       (p1 : ('a, 'b, 'c) context)
       (p2 : ('d, 'e, 'f) context)
       (combination_strategy : combination_strategy)
     : ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context =
-  (new combined_context p1 p2 combination_strategy
+  (new combined_context ?start_query2 p1 p2 combination_strategy
    : ('a, 'b, 'c, 'd, 'e, 'f) combined_context :> ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context)
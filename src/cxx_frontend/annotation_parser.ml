@@ -52,10 +52,13 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Parser = struct
   *)
   let ghost_macros = Hashtbl.create 10
 
+  (* Shared by all annotation lexers, so that their keyword tables are built only once. *)
+  let keywords = Parser.common_keywords @ Parser.c_keywords
+
   let make_lexer_token_stream_core (((start_loc, _), text) : raw_annotation) =
     let loc, ignore_eol, token_stream, _, _ =
       Lexer.make_lexer_core
-        (Parser.common_keywords @ Parser.c_keywords)
+        keywords
         Parser.ghost_keywords start_loc
         (text ^ "\n") (* append a newline to be able to parse //@ annotations *)
         Args.report_range false false true Args.report_should_fail
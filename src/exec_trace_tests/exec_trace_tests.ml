@@ -0,0 +1,37 @@
+open Verifast0
+
+(* Writes the forests of two files using a single writer, as vfconsole does, and reads them back. *)
+let () =
+  let path = Filename.temp_file "exec_trace_tests" ".trace" in
+  let chan = open_out_bin path in
+  let w = Exec_trace.create_writer chan in
+  (* First file *)
+  let f = Exec_trace.write_node w 0 (ExecNode ("Verifying function 'f'", [0])) in
+  let left = Exec_trace.write_node w f BranchNode in
+  let right = Exec_trace.write_node w f BranchNode in
+  ignore (Exec_trace.write_node w left SuccessNode);
+  let stmt = Exec_trace.write_node w right (ExecNode ("Executing statement", [1; 0])) in
+  ignore (Exec_trace.write_node w stmt ErrorNode);
+  (* Second file *)
+  let g = Exec_trace.write_node w 0 (ExecNode ("Verifying function 'g'", [0])) in
+  ignore (Exec_trace.write_node w g (ExecNode ("Executing statement", [0; 0])));
+  ignore (Exec_trace.write_node w g SuccessNode);
+  close_out chan;
+  let forest = Exec_trace.read_file path in
+  Sys.remove path;
+  assert (forest = [
+    Node (ExecNode ("Verifying function 'g'", [0]), ref [
+      Node (SuccessNode, ref []);
+      Node (ExecNode ("Executing statement", [0; 0]), ref [])
+    ]);
+    Node (ExecNode ("Verifying function 'f'", [0]), ref [
+      Node (BranchNode, ref [
+        Node (ExecNode ("Executing statement", [1; 0]), ref [
+          Node (ErrorNode, ref [])
+        ])
+      ]);
+      Node (BranchNode, ref [
+        Node (SuccessNode, ref [])
+      ])
+    ])
+  ])
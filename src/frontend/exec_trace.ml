@@ -0,0 +1,114 @@
+open Verifast0
+
+(*
+
+Binary trace of the symbolic execution forest (command-line option -exec_tree_trace).
+
+Instead of building the forest in memory, VeriFast can write each node to a
+trace file as soon as it is created. The file consists of the line
+"VeriFast-exec-trace 1", followed by a sequence of records. Each record starts
+with a tag byte; numbers are encoded as unsigned LEB128 varints.
+- 'M' len bytes: defines the next message (message ids count up from 0);
+- 'E' parent msg branch: an ExecNode;
+- 'B' parent: a BranchNode;
+- 'S' parent: a SuccessNode;
+- 'X' parent: an ErrorNode.
+Node ids count up from 1 in the order of the node records; parent 0 denotes the
+top level of the forest. When several files are verified, their forests are
+written one after the other by the same writer, so the file holds a single
+forest whose top-level nodes are those of all files. The path of an ExecNode is not stored; it is the
+node's branch number followed by the path of its nearest ExecNode ancestor.
+
+*)
+
+let format_version = "VeriFast-exec-trace 1"
+
+type writer = exec_trace_writer
+
+let create_writer chan =
+  output_string chan (format_version ^ "\n");
+  {trace_chan = chan; trace_msgs = Hashtbl.create 100; next_trace_node_id = 1}
+
+let rec output_varint chan n =
+  if n < 0x80 then
+    output_byte chan n
+  else begin
+    output_byte chan (0x80 lor (n land 0x7f));
+    output_varint chan (n lsr 7)
+  end
+
+let msg_id w msg =
+  match Hashtbl.find_opt w.trace_msgs msg with
+    Some id -> id
+  | None ->
+    let id = Hashtbl.length w.trace_msgs in
+    Hashtbl.add w.trace_msgs msg id;
+    output_char w.trace_chan 'M';
+    output_varint w.trace_chan (String.length msg);
+    output_string w.trace_chan msg;
+    id
+
+(** Writes a node with parent [parent] and returns its id. *)
+let write_node w parent nodeType =
+  begin match nodeType with
+    ExecNode (msg, path) ->
+    let msg = msg_id w msg in
+    output_char w.trace_chan 'E';
+    output_varint w.trace_chan parent;
+    output_varint w.trace_chan msg;
+    output_varint w.trace_chan (match path with branch::_ -> branch | [] -> 0)
+  | BranchNode -> output_char w.trace_chan 'B'; output_varint w.trace_chan parent
+  | SuccessNode -> output_char w.trace_chan 'S'; output_varint w.trace_chan parent
+  | ErrorNode -> output_char w.trace_chan 'X'; output_varint w.trace_chan parent
+  end;
+  let id = w.next_trace_node_id in
+  w.next_trace_node_id <- id + 1;
+  id
+
+let rec input_varint chan =
+  let b = input_byte chan in
+  if b < 0x80 then b else (b land 0x7f) lor (input_varint chan lsl 7)
+
+(** Reads a trace file into a forest, as built by VeriFast in BuildExecTree mode. *)
+let read_file path =
+  let chan = open_in_bin path in
+  Fun.protect ~finally:(fun () -> close_in chan) begin fun () ->
+    if input_line chan <> format_version then failwith (path ^ ": not a VeriFast execution trace");
+    let msgs = Hashtbl.create 100 in
+    (* Maps each node id to the node's children and the path of the node's nearest ExecNode ancestor-or-self *)
+    let nodes = Hashtbl.create 10000 in
+    let forest = ref [] in
+    Hashtbl.add nodes 0 (forest, []);
+    let next_node_id = ref 1 in
+    let add_node parent nodeType path =
+      let (siblings, _) = Hashtbl.find nodes parent in
+      let children = ref [] in
+      siblings := Node (nodeType, children)::!siblings;
+      Hashtbl.add nodes !next_node_id (children, path);
+      incr next_node_id
+    in
+    let parent_path parent = snd (Hashtbl.find nodes parent) in
+    let rec iter () =
+      match input_char chan with
+        exception End_of_file -> ()
+      | 'M' ->
+        let len = input_varint chan in
+        Hashtbl.add msgs (Hashtbl.length msgs) (really_input_string chan len);
+        iter ()
+      | 'E' ->
+        let parent = input_varint chan in
+        let msg = input_varint chan in
+        let branch = input_varint chan in
+        let path = branch::parent_path parent in
+        add_node parent (ExecNode (Hashtbl.find msgs msg, path)) path;
+        iter ()
+      | 'B' | 'S' | 'X' as tag ->
+        let parent = input_varint chan in
+        add_node parent (match tag with 'B' -> BranchNode | 'S' -> SuccessNode | _ -> ErrorNode) (parent_path parent);
+        iter ()
+      | _ -> failwith (path ^ ": corrupt VeriFast execution trace")
+    in
+    (* A trace that was cut off, e.g. because VeriFast was killed, is read up to the last complete record. *)
+    begin try iter () with End_of_file -> () end;
+    !forest
+  end
@@ -415,6 +415,30 @@ let string_of_range_kind = function
   | CommentRange        -> "CommentRange"
   | ErrorRange          -> "ErrorRange"
 
+(* The keyword tables for a given pair of keyword lists are built only once. Some frontends create a lexer
+   per annotation, so building the tables anew for each lexer would dominate lexing time. The tables must
+   not be mutated. *)
+let keyword_tables: (string list * string list, (string, token) Hashtbl.t * (string, token) Hashtbl.t) Hashtbl.t = Hashtbl.create 8
+let last_keyword_tables = ref None
+
+let get_keyword_tables keywords ghostKeywords =
+  match !last_keyword_tables with
+    Some (keywords0, ghostKeywords0, tables) when keywords0 == keywords && ghostKeywords0 == ghostKeywords -> tables
+  | _ ->
+    let tables =
+      match Hashtbl.find_opt keyword_tables (keywords, ghostKeywords) with
+        Some tables -> tables
+      | None ->
+        let kwd_table = Hashtbl.create 17 in
+        List.iter (fun s -> Hashtbl.add kwd_table s (Kwd s)) keywords;
+        let ghost_kwd_table = Hashtbl.create 17 in
+        List.iter (fun s -> Hashtbl.add ghost_kwd_table s (Kwd s)) (keywords @ ghostKeywords);
+        Hashtbl.add keyword_tables (keywords, ghostKeywords) (kwd_table, ghost_kwd_table);
+        (kwd_table, ghost_kwd_table)
+    in
+    last_keyword_tables := Some (keywords, ghostKeywords, tables);
+    tables
+
 (** The lexer.
     @param reportShouldFail Function that will be called whenever a should-fail directive is found in the source code.
       Should-fail directives are of the form //~ and are used for writing negative VeriFast test inputs. See tests/errors.
@@ -516,10 +540,8 @@ let make_lexer_core keywords ghostKeywords startpos text reportRange inComment i
     end
   in
   
-  let kwd_table = Hashtbl.create 17 in
-  List.iter (fun s -> Hashtbl.add kwd_table s (Kwd s)) keywords;
-  let ghost_kwd_table = Hashtbl.create 17 in
-  List.iter (fun s -> Hashtbl.add ghost_kwd_table s (Kwd s)) (keywords @ ghostKeywords);
+  let (kwd_table, ghost_kwd_table) = get_keyword_tables keywords ghostKeywords in
+  let is_rust = Hashtbl.mem kwd_table "'a" in
   let get_kwd_table() = if !ghost_range_start = None then kwd_table else ghost_kwd_table in
   let ident_or_keyword id isAlpha =
     report_nontrivial_token();
@@ -648,7 +670,7 @@ let make_lexer_core keywords ghostKeywords startpos text reportRange inComment i
         in
         begin match text_peek (), c with
           '\'', _ -> text_junk (); Some (CharToken c)
-        | _, ('A'..'Z'|'a'..'z'|'_') when Hashtbl.mem kwd_table "'a" ->
+        | _, ('A'..'Z'|'a'..'z'|'_') when is_rust ->
           reset_buffer ();
           store c;
           let rec iter () =
@@ -699,7 +721,7 @@ let make_lexer_core keywords ghostKeywords startpos text reportRange inComment i
       ('A'..'Z' | 'a'..'z' | '\128'..'\255' | '0'..'9' | '_' | '\'' | '$') as c ->
       text_junk (); store c; ident ()
     (* for C++ nested names, e.g. foo::bar *) (* In Rust code, don't treat :: as part of an identifier *)
-    | ':' when (text_peekn 1) = ':' && not (Hashtbl.mem kwd_table "'a") ->
+    | ':' when (text_peekn 1) = ':' && not is_rust ->
       text_junk (); text_junk (); store ':'; store ':'; ident ()
     | _ -> Some (ident_or_keyword (get_string ()) true)
   and ident2 () =
@@ -1023,6 +1045,7 @@ class type t_lexer =
     method loc           : unit -> loc0
     method reset         : unit -> unit
     method commit        : unit -> unit
+    method commit_alone  : unit -> unit
     method reset_fully   : unit
   end
 
@@ -1061,6 +1084,11 @@ class tentative_lexer (lloc:unit -> loc0) (lstream:(loc0 * token) Stream.t) : t_
       base <- base + counter;
       counter <- 0;
       counter_old <- 0;
+    (* Commits the tokens consumed by a single preprocessor, without comparing against a second one. *)
+    method commit_alone() =
+      base <- base + counter;
+      counter <- 0;
+      counter_old <- 0;
     
     method private fetch () =
       if fetched < (Array.length buffer) then begin
@@ -1762,25 +1790,106 @@ let make_file_preprocessor0 reportMacroCall path get_macro set_macro peek junk i
   in
   (make_subpreprocessor [] peek junk, fun _ -> !last_macro_used)
 
-let make_file_preprocessor reportMacroCall path macros ghost_macros peek junk in_ghost_range dataModel =
+(* [on_macro_access macros x is_definition] is called before macro [x] is looked up in, or defined in or removed
+   from, table [macros]. *)
+let make_file_preprocessor ?(on_macro_access = fun _ _ _ -> ()) reportMacroCall path macros ghost_macros peek junk in_ghost_range dataModel =
   let get_macros () = if !in_ghost_range then ghost_macros else macros in
   let set_macro x v =
+    let macros = get_macros () in
+    on_macro_access macros x true;
     match v with
-      Some v -> Hashtbl.replace (get_macros ()) x v
-    | None -> Hashtbl.remove (get_macros ()) x
+      Some v -> Hashtbl.replace macros x v
+    | None -> Hashtbl.remove macros x
+  in
+  let find_macro macros x =
+    on_macro_access macros x false;
+    Hashtbl.find_opt macros x
   in
   let get_macro l x =
     if !in_ghost_range then
-      match Hashtbl.find_opt ghost_macros x with
-        None -> Hashtbl.find_opt macros x
+      match find_macro ghost_macros x with
+        None -> find_macro macros x
       | result -> result
     else
-      Hashtbl.find_opt macros x
+      find_macro macros x
   in
   make_file_preprocessor0 reportMacroCall path get_macro set_macro peek junk in_ghost_range dataModel
 
 let is_ghost_header h = Filename.check_suffix h ".gh"
 
+(* Region: memoization of context-free headers *)
+
+(* The sound preprocessor runs the normal preprocessor and the context-free preprocessor in lockstep,
+   to check that the expansion of each header does not depend on the macros defined by its includer.
+   Once a header has passed this check in a given context, and provided none of the files it expanded has
+   changed, it passes it again in any context that agrees with that one on the header's dependencies:
+   - the macros that the normal preprocessor looked up before the header defined them, and the macros
+     it defined (so that any context-dependent behavior of a definition is accounted for);
+   - for each file the header tried to include, whether it was included already (which makes the
+     inclusion a secondary include).
+   Therefore, when a header is included again in such a context (typically by a later file in the
+   same VeriFast run, or by a later verification in the IDE or the verification server), only the
+   normal preprocessor is run.
+   The context-free preprocessor's macro tables for the header and the headers it includes are recorded
+   as well, so that they can be restored when the context-free preprocessor resumes. *)
+type ('macros, 'macro) context_free_header = {
+  cfh_config: string; (* The preprocessor configuration: include paths, data model, and predefined macros *)
+  cfh_files: (string * Digest.t) list; (* The files expanded by the header, including itself *)
+  cfh_macro_deps: (string * 'macro option) list; (* The macros the header depends on, and their values *)
+  cfh_ghost_macro_deps: (string * 'macro option) list;
+  cfh_included_before: string list; (* The files the header tried to include that were included already *)
+  cfh_header_macros: (string * 'macros) list; (* The context-free preprocessor's macros of each expanded file *)
+  cfh_header_ghost_macros: (string * 'macros) list;
+}
+
+(* Maps each header's path to the contexts in which it was found to be context-free. *)
+let context_free_headers = Hashtbl.create 100
+
+(* If true, headers are always checked by running both preprocessors. *)
+let audit_context_free_headers = ref false
+
+let digest_of_file path = try Some (Digest.file path) with Sys_error _ -> None
+
+let context_free_header_files_unchanged entry =
+  List.for_all (fun (path, digest) -> digest_of_file path = Some digest) entry.cfh_files
+
+let find_context_free_header config path macros ghost_macros included_files =
+  let matches entry =
+    entry.cfh_config = config &&
+    List.for_all (fun (x, v) -> Hashtbl.find_opt macros x = v) entry.cfh_macro_deps &&
+    List.for_all (fun (x, v) -> Hashtbl.find_opt ghost_macros x = v) entry.cfh_ghost_macro_deps &&
+    List.for_all (fun path -> List.mem path included_files) entry.cfh_included_before &&
+    List.for_all (fun (path, _) -> not (List.mem path included_files)) entry.cfh_files &&
+    context_free_header_files_unchanged entry
+  in
+  List.find_opt matches (Hashtbl.find_all context_free_headers path)
+
+(* Adds [entry] for header [path], dropping the entries that are stale or have the same dependencies. *)
+let add_context_free_header path entry =
+  let same_deps entry' =
+    entry'.cfh_config = entry.cfh_config &&
+    entry'.cfh_macro_deps = entry.cfh_macro_deps &&
+    entry'.cfh_ghost_macro_deps = entry.cfh_ghost_macro_deps &&
+    entry'.cfh_included_before = entry.cfh_included_before
+  in
+  let entries = Hashtbl.find_all context_free_headers path in
+  List.iter (fun _ -> Hashtbl.remove context_free_headers path) entries;
+  let entries = List.filter (fun entry' -> not (same_deps entry') && context_free_header_files_unchanged entry') entries in
+  List.iter (Hashtbl.add context_free_headers path) (List.rev (entry::entries))
+
+(* The dependencies recorded while a header is expanded by both preprocessors in lockstep *)
+type 'macro checked_header = {
+  ch_path: string;
+  ch_included_files_count: int; (* The length of included_files when the header's expansion started *)
+  ch_cache_length: int; (* The lengths of the context-free preprocessor's macro caches at that time *)
+  ch_ghost_cache_length: int;
+  ch_macro_deps: (string, 'macro option option) Hashtbl.t; (* [None] for macros defined before they were looked up *)
+  ch_ghost_macro_deps: (string, 'macro option option) Hashtbl.t;
+  mutable ch_included_before: string list;
+}
+
+let rec take n xs = if n = 0 then [] else match xs with [] -> [] | x::xs -> x::take (n - 1) xs
+
 let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include_paths dataModel define_macros p_ghost_macros included_files =
   if verbose = -1 then Printf.printf "%10.6fs: >> start preprocessing file: %s\n" (Perf.time()) path;
   let mk_macros0 () =
@@ -1851,9 +1960,26 @@ let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include
     in
     Hashtbl.iter (fun k v -> Hashtbl.replace macros2 k v) macros1
   in
+  (* Headers being expanded by the normal preprocessor and the context-free preprocessor in lockstep, innermost first *)
+  let checked_headers = ref [] in
+  let record_macro_access macros x is_definition =
+    if !checked_headers <> [] then begin
+      let is_ghost = macros == p_ghost_macros in
+      !checked_headers |> List.iter begin fun header ->
+        let deps = if is_ghost then header.ch_ghost_macro_deps else header.ch_macro_deps in
+        if not (Hashtbl.mem deps x) then
+          Hashtbl.add deps x (if is_definition then None else Some (Hashtbl.find_opt macros x))
+      end
+    end
+  in
+  (* The number of nested headers being expanded by the normal preprocessor only, and the memoized
+     context-free header at the root of these. *)
+  let single_pass_depth = ref 0 in
+  let single_pass_header = ref None in
+  let context_config = Marshal.to_string (include_paths, dataModel, define_macros) [] in
   let current_loc () = !curr_tlexer#loc() in
   let () =
-    let pp0, last_macro_used0 = make_file_preprocessor reportMacroCall path p_macros p_ghost_macros (fun () -> !curr_tlexer#peek ()) (fun () -> !curr_tlexer#junk ()) p_in_ghost_range dataModel in
+    let pp0, last_macro_used0 = make_file_preprocessor ~on_macro_access:record_macro_access reportMacroCall path p_macros p_ghost_macros (fun () -> !curr_tlexer#peek ()) (fun () -> !curr_tlexer#junk ()) p_in_ghost_range dataModel in
     pps := [pp0];
     p_last_macro_used := [last_macro_used0]
   in
@@ -1889,12 +2015,68 @@ let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include
     begin match !tlexers with _::_::_ -> pop_tlexer() | _ -> () end;
     raise (PreprocessorDivergence (l , s))    
   in
+  let push_p_pp path =
+    let pp1, last_macro_used1 = make_file_preprocessor ~on_macro_access:record_macro_access reportMacroCall path p_macros p_ghost_macros (fun () -> !curr_tlexer#peek ()) (fun () -> !curr_tlexer#junk ()) p_in_ghost_range dataModel in
+    pps := pp1::!pps;
+    p_last_macro_used := last_macro_used1::!p_last_macro_used
+  in
+  let pop_p_pp () =
+    pps := List.tl !pps;
+    p_last_macro_used := List.tl !p_last_macro_used
+  in
+  (* Called when the single-pass expansion of a memoized context-free header ends. Restores the
+     context-free preprocessor's state as if it had expanded the header in lockstep. *)
+  let end_single_pass_header path entry =
+    let restore cache entries =
+      List.rev entries |> List.iter (fun (path, macros) -> if not (List.mem_assoc path !cache) then cache := (path, macros)::!cache)
+    in
+    restore cfp_header_macros_cache entry.cfh_header_macros;
+    restore cfp_header_ghost_macros_cache entry.cfh_header_ghost_macros;
+    let merge cache macros2 = Hashtbl.iter (fun k v -> Hashtbl.replace macros2 k v) (List.assoc path !cache) in
+    merge cfp_header_macros_cache (List.hd !cfp_macros);
+    merge cfp_header_ghost_macros_cache (List.hd !cfp_ghost_macros);
+    cfp_in_ghost_range := !p_in_ghost_range
+  in
+  (* Called when the lockstep expansion of a header ends without divergence. *)
+  let end_checked_header path =
+    match !checked_headers with
+      header::headers when header.ch_path = path ->
+      checked_headers := headers;
+      let files = take (List.length !included_files - header.ch_included_files_count) !included_files in
+      let digests = List.filter_map (fun path -> Option.map (fun digest -> (path, digest)) (digest_of_file path)) files in
+      let header_macros = take (List.length !cfp_header_macros_cache - header.ch_cache_length) !cfp_header_macros_cache in
+      let header_ghost_macros = take (List.length !cfp_header_ghost_macros_cache - header.ch_ghost_cache_length) !cfp_header_ghost_macros_cache in
+      let macro_deps deps = Hashtbl.fold (fun x v deps -> match v with Some v -> (x, v)::deps | None -> deps) deps [] in
+      if List.length digests = List.length files && List.mem_assoc path header_macros && List.mem_assoc path header_ghost_macros then
+        add_context_free_header path {
+          cfh_config = context_config;
+          cfh_files = digests;
+          cfh_macro_deps = macro_deps header.ch_macro_deps;
+          cfh_ghost_macro_deps = macro_deps header.ch_ghost_macro_deps;
+          cfh_included_before = header.ch_included_before;
+          cfh_header_macros = header_macros;
+          cfh_header_ghost_macros = header_ghost_macros
+        }
+    | _::headers -> checked_headers := headers
+    | [] -> ()
+  in
   let rec next_token () =
+    if !single_pass_depth > 0 then begin
+      let p_t = p_next() in
+      !curr_tlexer#commit_alone();
+      process_token p_t
+    end else
     let p_t = p_next() in
     !curr_tlexer#reset();
     let cfp_t = cfp_next() in
     !curr_tlexer#commit();
-    if compare_tokens p_t cfp_t && !p_in_ghost_range = !cfp_in_ghost_range then begin
+    if compare_tokens p_t cfp_t && !p_in_ghost_range = !cfp_in_ghost_range then
+      process_token p_t
+    else begin
+      match last_macro_used() with
+        (l,m) -> divergence (current_loc ()) ("The C preprocessor and the context-free preprocessor produced different tokens. The expansion of a header cannot depend upon its context of defined macros (macro " ^ m ^ ")")
+    end
+  and process_token p_t =
       begin match p_t with
         Some (l,BeginInclude(kind, i, _)) ->    
           let path0 = List.hd !paths in
@@ -1953,12 +2135,55 @@ let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include
               (* The safest version: *)
               (* error (current_loc()) (Printf.sprintf "Cannot include file '%s' because multiple possible include paths are found." i) *)
           in
-          let path = abs_path (find_include_file includepaths) in push_tlexer l path;
-          let () =
-            let pp1, last_macro_used1 = make_file_preprocessor reportMacroCall path p_macros p_ghost_macros (fun () -> !curr_tlexer#peek ()) (fun () -> !curr_tlexer#junk ()) p_in_ghost_range dataModel in
-            pps := pp1::!pps;
-            p_last_macro_used := last_macro_used1::!p_last_macro_used
+          let path = abs_path (find_include_file includepaths) in
+          let is_secondary_include = List.mem path !included_files in
+          if is_secondary_include then begin
+            (* Record the dependency of the enclosing checked headers on [path] having been included before them *)
+            let included_files_count = List.length !included_files in
+            !checked_headers |> List.iter begin fun header ->
+              if not (List.mem path (take (included_files_count - header.ch_included_files_count) !included_files)) && not (List.mem path header.ch_included_before) then
+                header.ch_included_before <- path::header.ch_included_before
+            end
+          end;
+          let context_free_header =
+            if !single_pass_depth > 0 || is_secondary_include then
+              None
+            else begin
+              match if !audit_context_free_headers then None else find_context_free_header context_config path p_macros p_ghost_macros !included_files with
+                Some entry -> Some entry
+              | None ->
+                checked_headers := {
+                  ch_path = path;
+                  ch_included_files_count = List.length !included_files;
+                  ch_cache_length = List.length !cfp_header_macros_cache;
+                  ch_ghost_cache_length = List.length !cfp_header_ghost_macros_cache;
+                  ch_macro_deps = Hashtbl.create 10;
+                  ch_ghost_macro_deps = Hashtbl.create 10;
+                  ch_included_before = []
+                }::!checked_headers;
+                None
+            end
           in
+          push_tlexer l path;
+          push_p_pp path;
+          if !single_pass_depth > 0 || context_free_header <> None then begin
+            if !single_pass_depth = 0 then single_pass_header := context_free_header;
+            incr single_pass_depth;
+            if is_secondary_include then begin
+              match p_next() with
+              | Some (_, Eof) ->
+                  let None = p_next () in
+                  if verbose = -1 then Printf.printf "%10.6fs: >>>> secondary include: %s\n" (Perf.time()) path;
+                  pop_p_pp ();
+                  decr single_pass_depth;
+                  (pop_tlexer(); Some(l, SecondaryInclude(i, path)))
+              | Some _ -> let Lexed l = l in divergence l ("Preprocessor does not skip secondary inclusion of file \n" ^ path)
+            end else begin
+              if verbose = -1 then Printf.printf "%10.6fs: >>>> including file (single pass): %s\n" (Perf.time()) path;
+              included_files := path::!included_files;
+              Some (l,BeginInclude(kind, i, path))
+            end
+          end else begin
           let () =
             let macros = mk_macros0 () in
             let ghost_macros = Hashtbl.create 10 in
@@ -1967,7 +2192,7 @@ let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include
             let cfpp1, _ = make_file_preprocessor reportMacroCall path macros ghost_macros (fun () -> !curr_tlexer#peek ()) (fun () -> !curr_tlexer#junk ()) cfp_in_ghost_range dataModel in
             cfpps := cfpp1::!cfpps
           in
-          if List.mem path !included_files then begin
+          if is_secondary_include then begin
             match p_next() with
             | Some (_, Eof) -> 
                 let None = p_next () in
@@ -1981,11 +2206,24 @@ let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include
             included_files := path::!included_files;
             Some (l,BeginInclude(kind, i, path))
           end
+          end
       | None ->
         if List.length !tlexers > 1 then begin
-          if verbose = -1 then begin let path = List.hd !paths in Printf.printf "%10.6fs: >>>> end including file: %s\n" (Perf.time()) path end;
+          let path = List.hd !paths in
+          if verbose = -1 then Printf.printf "%10.6fs: >>>> end including file: %s\n" (Perf.time()) path;
           let l = current_loc () in
-          pop_pps ();
+          if !single_pass_depth > 0 then begin
+            pop_p_pp ();
+            decr single_pass_depth;
+            if !single_pass_depth = 0 then begin
+              let Some entry = !single_pass_header in
+              single_pass_header := None;
+              end_single_pass_header path entry
+            end
+          end else begin
+            pop_pps ();
+            end_checked_header path
+          end;
           pop_tlexer();
           Some (Lexed l, EndInclude)
         end else begin
@@ -1994,11 +2232,6 @@ let make_sound_preprocessor_core reportMacroCall make_lexer path verbose include
         end
       | _ -> p_t
       end
-    end
-    else begin
-      match last_macro_used() with
-        (l,m) -> divergence (current_loc ()) ("The C preprocessor and the context-free preprocessor produced different tokens. The expansion of a header cannot depend upon its context of defined macros (macro " ^ m ^ ")")
-    end
   in
   let current_loc = ref dummy_loc in
   let next _ =
@@ -5,10 +5,37 @@ open Ast
 
 let parsing_stopwatch = Stopwatch.create ()
 
+(* If true, printStats also reports the number of words allocated by the OCaml runtime. *)
+let report_allocations = ref false
+
+let format_timings timings =
+  let compare (_, t1) (_, t2) = compare t1 t2 in
+  let timingsSorted = List.sort compare timings in
+  let max_funName_length = List.fold_left (fun m (n, _) -> max m (String.length n)) 0 timingsSorted in
+  String.concat "" (List.map (fun (funName, seconds) -> Printf.sprintf "  %-*s: %6.2f seconds\n" max_funName_length funName seconds) timingsSorted)
+
+(** The peak resident set size of this process, if known (Linux only). *)
+let peak_rss_kb () =
+  match open_in "/proc/self/status" with
+    exception Sys_error _ -> None
+  | chan ->
+    let rec iter () =
+      match input_line chan with
+        exception End_of_file -> None
+      | line ->
+        match Scanf.sscanf line "VmHWM: %d kB" (fun kb -> kb) with
+          kb -> Some kb
+        | exception (Scanf.Scan_failure _ | End_of_file | Failure _) -> iter ()
+    in
+    let result = iter () in
+    close_in chan;
+    result
+
 class stats =
   object (self)
     val startTime = Perf.time()
     val startTicks = Stopwatch.processor_ticks()
+    val startAllocatedBytes = Gc.allocated_bytes ()
     val mutable successQualifier: string option = None
     val mutable stmtsParsedCount = 0
     val mutable openParsedCount = 0
@@ -17,14 +44,25 @@ class stats =
     val mutable stmtExecLocs = Hashtbl.create 1000;
     val mutable execStepCount = 0
     val mutable branchCount = 0
+    val mutable pathsMergedCount = 0
+    val mutable failedRuleApplicationsSkippedCount = 0
     val mutable proverAssumeCount = 0
     val mutable definitelyEqualSameTermCount = 0
     val mutable definitelyEqualQueryCount = 0
     val mutable proverOtherQueryCount = 0
     val mutable proverStats = ""
+    val mutable proverCounters: (string * int) list = []
+    val mutable proverTimes: (string * float) list = []
+    val mutable headerCheckDepth = 0
+    val mutable headerCheckTime = 0.0
     val mutable overhead: <path: string; nonghost_lines: int; ghost_lines: int; mixed_lines: int> list = []
     val mutable functionTimings: (string * float) list = []
-    
+    val mutable bodyTranslationCount = 0
+    val mutable bodyTranslationTime = 0.0
+    val mutable bodyTranslationTimings: (string * float) list = []
+    val mutable cachedFunctionCount = 0
+    val mutable functionsOverBudget: (string * string * (string * int) list) list = []
+
     method tickLength = let t1 = Perf.time() in let ticks1 = Stopwatch.processor_ticks() in (t1 -. startTime) /. Int64.to_float (Int64.sub ticks1 startTicks)
 
     method success_qualifier = successQualifier
@@ -38,11 +76,19 @@ class stats =
           None -> ""
         | Some qualifier -> Printf.sprintf " (%s)" qualifier
       in
-      Printf.sprintf "0 errors found (%d statements verified)%s" self#getStmtExec qualifierText
+      let cachedText =
+        if cachedFunctionCount = 0 then "" else Printf.sprintf " (%d functions cached)" cachedFunctionCount
+      in
+      Printf.sprintf "0 errors found (%d statements verified)%s%s" self#getStmtExec qualifierText cachedText
 
     method stmtParsed = stmtsParsedCount <- stmtsParsedCount + 1
     method openParsed = openParsedCount <- openParsedCount + 1
     method closeParsed = closeParsedCount <- closeParsedCount + 1
+    method parseCounters = (stmtsParsedCount, openParsedCount, closeParsedCount)
+    method addParseCounters (stmts, opens, closes) =
+      stmtsParsedCount <- stmtsParsedCount + stmts;
+      openParsedCount <- openParsedCount + opens;
+      closeParsedCount <- closeParsedCount + closes
     method stmtExec (l: loc) =
       stmtExecOnAllPathsCount <- stmtExecOnAllPathsCount + 1;
       Hashtbl.replace stmtExecLocs l l
@@ -51,22 +97,45 @@ class stats =
     method getStmtExecOnAllPaths = stmtExecOnAllPathsCount
     method execStep = execStepCount <- execStepCount + 1
     method branch = branchCount <- branchCount + 1
+    method pathsMerged = pathsMergedCount <- pathsMergedCount + 1
+    method failedRuleApplicationSkipped = failedRuleApplicationsSkippedCount <- failedRuleApplicationsSkippedCount + 1
     method proverAssume = proverAssumeCount <- proverAssumeCount + 1
     method definitelyEqualSameTerm = definitelyEqualSameTermCount <- definitelyEqualSameTermCount + 1
     method definitelyEqualQuery = definitelyEqualQueryCount <- definitelyEqualQueryCount + 1
     method proverOtherQuery = proverOtherQueryCount <- proverOtherQueryCount + 1
+    method functionCached = cachedFunctionCount <- cachedFunctionCount + 1
+    (** Records that function [funName] exceeded [budget]; [hottestLines] lists the source lines on which it spent the most execution steps. *)
+    method functionBudgetExceeded funName (budget: string) (hottestLines: (string * int) list) =
+      functionsOverBudget <- (funName, budget, hottestLines)::functionsOverBudget
+    method functionsOverBudget = List.rev functionsOverBudget
+    method functionsOverBudgetJson =
+      let open Json in
+      A (self#functionsOverBudget |> List.map begin fun (funName, budget, hottestLines) ->
+        O ["function", S funName; "budget", S budget; "hottestLines", A (List.map (fun (line, steps) -> A [S line; I steps]) hottestLines)]
+      end)
     method appendProverStats (text, tickCounts) =
       let tickLength = self#tickLength in
-      proverStats <- proverStats ^ text ^ String.concat "" (List.map (fun (lbl, ticks) -> Printf.sprintf "%s: %.6fs\n" lbl (Int64.to_float ticks *. tickLength)) tickCounts)
+      let times = List.map (fun (lbl, ticks) -> (lbl, Int64.to_float ticks *. tickLength)) tickCounts in
+      proverTimes <- proverTimes @ times;
+      proverStats <- proverStats ^ text ^ String.concat "" (List.map (fun (lbl, seconds) -> Printf.sprintf "%s: %.6fs\n" lbl seconds) times)
+    method appendProverCounters counters = proverCounters <- proverCounters @ counters
+    (** Runs [f], which checks a header file. Only the outermost header check is timed, since checking a header checks the headers it includes. *)
+    method timeHeaderCheck: 'a. (unit -> 'a) -> 'a = fun f ->
+      if headerCheckDepth > 0 then f () else begin
+        let time0 = Perf.time () in
+        headerCheckDepth <- 1;
+        let finally () = headerCheckDepth <- 0; headerCheckTime <- headerCheckTime +. (Perf.time () -. time0) in
+        Fun.protect ~finally f
+      end
     method overhead ~path ~nonGhostLineCount ~ghostLineCount ~mixedLineCount =
       let o = object method path = path method nonghost_lines = nonGhostLineCount method ghost_lines = ghostLineCount method mixed_lines = mixedLineCount end in
       overhead <- o::overhead
     method recordFunctionTiming funName seconds = if seconds > 0.1 then functionTimings <- (funName, seconds)::functionTimings
-    method getFunctionTimings =
-      let compare (_, t1) (_, t2) = compare t1 t2 in
-      let timingsSorted = List.sort compare functionTimings in
-      let max_funName_length = List.fold_left (fun m (n, _) -> max m (String.length n)) 0 timingsSorted in
-      String.concat "" (List.map (fun (funName, seconds) -> Printf.sprintf "  %-*s: %6.2f seconds\n" max_funName_length funName seconds) timingsSorted)
+    method getFunctionTimings = format_timings functionTimings
+    method recordBodyTranslationTiming bodyName seconds =
+      bodyTranslationCount <- bodyTranslationCount + 1;
+      bodyTranslationTime <- bodyTranslationTime +. seconds;
+      if seconds > 0.01 then bodyTranslationTimings <- (bodyName, seconds)::bodyTranslationTimings
     
     method printStats =
       print_endline ("Syntactic annotation overhead statistics:");
@@ -83,16 +152,66 @@ class stats =
       print_endline ("Close statements parsed: " ^ string_of_int closeParsedCount);
       print_endline ("Statement executions: " ^ string_of_int (self#getStmtExec));
       print_endline ("Execution steps (including assertion production/consumption steps): " ^ string_of_int execStepCount);
+      if !report_allocations then begin
+        let allocatedWords = (Gc.allocated_bytes () -. startAllocatedBytes) /. float_of_int (Sys.word_size / 8) in
+        Printf.printf "Words allocated: %.0f (%.0f per execution step)\n" allocatedWords (allocatedWords /. float_of_int (max 1 execStepCount))
+      end;
       print_endline ("Symbolic execution forks: " ^ string_of_int branchCount);
+      if pathsMergedCount > 0 then
+        print_endline ("Conditional statements merged at their join point (each saves one execution of the rest of the function): " ^ string_of_int pathsMergedCount);
+      if failedRuleApplicationsSkippedCount > 0 then
+        print_endline ("Automation rule applications skipped because they failed before in the same prover state: " ^ string_of_int failedRuleApplicationsSkippedCount);
       print_endline ("Prover assumes: " ^ string_of_int proverAssumeCount);
       print_endline ("Term equality tests -- same term: " ^ string_of_int definitelyEqualSameTermCount);
       print_endline ("Term equality tests -- prover query: " ^ string_of_int definitelyEqualQueryCount);
       print_endline ("Term equality tests -- total: " ^ string_of_int (definitelyEqualSameTermCount + definitelyEqualQueryCount));
       print_endline ("Other prover queries: " ^ string_of_int proverOtherQueryCount);
+      print_endline ("Functions skipped (cached result): " ^ string_of_int cachedFunctionCount);
       print_endline ("Prover statistics:\n" ^ proverStats);
       Printf.printf "Time spent parsing: %.6fs\n" (Int64.to_float (Stopwatch.ticks parsing_stopwatch) *. self#tickLength);
+      if bodyTranslationCount > 0 then begin
+        Printf.printf "Rust function bodies translated: %d (%.2f seconds)\n" bodyTranslationCount bodyTranslationTime;
+        print_endline ("Rust function body translation timings (> 0.01s):\n" ^ format_timings bodyTranslationTimings)
+      end;
       print_endline ("Function timings (> 0.1s):\n" ^ self#getFunctionTimings);
       print_endline (Printf.sprintf "Total time: %.2f seconds" (Perf.time() -. startTime))
+
+    (** The statistics as a JSON object, for command-line option -stats_json. Times are in seconds. *)
+    method json =
+      let open Json in
+      let timings timings = O (List.rev_map (fun (name, seconds) -> (name, F seconds)) timings) in
+      let gc = Gc.quick_stat () in
+      O [
+        "totalTime", F (Perf.time () -. startTime);
+        "parseTime", F (Int64.to_float (Stopwatch.ticks parsing_stopwatch) *. self#tickLength);
+        "headerCheckTime", F headerCheckTime;
+        "statementsParsed", I stmtsParsedCount;
+        "statementExecutions", I self#getStmtExec;
+        "executionSteps", I execStepCount;
+        "symbolicExecutionForks", I branchCount;
+        "pathsMerged", I pathsMergedCount;
+        "failedRuleApplicationsSkipped", I failedRuleApplicationsSkippedCount;
+        "proverAssumes", I proverAssumeCount;
+        "definitelyEqualSameTerm", I definitelyEqualSameTermCount;
+        "definitelyEqualQuery", I definitelyEqualQueryCount;
+        "otherProverQueries", I proverOtherQueryCount;
+        "cachedFunctions", I cachedFunctionCount;
+        "functionsOverBudget", self#functionsOverBudgetJson;
+        "functionTimings", timings functionTimings;
+        "rustBodiesTranslated", I bodyTranslationCount;
+        "rustBodyTranslationTime", F bodyTranslationTime;
+        "prover", O ["counters", O (List.map (fun (name, count) -> (name, I count)) proverCounters); "times", O (List.map (fun (name, seconds) -> (name, F seconds)) proverTimes)];
+        "gc", O [
+          "minorWords", F gc.Gc.minor_words;
+          "promotedWords", F gc.Gc.promoted_words;
+          "majorWords", F gc.Gc.major_words;
+          "minorCollections", I gc.Gc.minor_collections;
+          "majorCollections", I gc.Gc.major_collections;
+          "compactions", I gc.Gc.compactions;
+          "topHeapWords", I gc.Gc.top_heap_words
+        ];
+        "peakRssKb", (match peak_rss_kb () with None -> Null | Some kb -> I kb)
+      ]
   end
 
 let stats = ref (new stats)
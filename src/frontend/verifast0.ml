@@ -305,6 +305,22 @@ end) = struct
 end
 
 exception RustcErrors of loc * string * Json.json list
+
+(* If true, the Rust frontend keeps a vf-rust-mir-exporter process running and reuses it for subsequent verifications. *)
+let persistent_rust_exporter = ref false
+
+(* The number of worker processes the Rust frontend uses to translate function bodies. If 1, the bodies are translated in the VeriFast process itself. *)
+let rust_translation_jobs = ref 1
+
+(* The state of a writer of the trace format of module Exec_trace; see Exec_trace.create_writer. *)
+type exec_trace_writer = {trace_chan: out_channel; trace_msgs: (string, int) Hashtbl.t; mutable next_trace_node_id: int}
+
+type exec_tree_mode =
+  BuildExecTree (* Build the symbolic execution forest in memory and report it through the reportExecutionForest callback. *)
+| NoExecTree (* Do not record the symbolic execution forest. *)
+| StreamExecTree of exec_trace_writer (* Write the symbolic execution forest using the given writer. The forests of all files verified by this process go to the same writer. *)
+
+let exec_tree_mode = ref BuildExecTree
 exception SymbolicExecutionError of string context list * loc * string * error_attribute list option
 
 (* prepends '~' to the given record name *)
@@ -485,6 +501,10 @@ type options = {
   option_enforce_annotations : bool;
   option_report_skipped_stmts: bool; (* Report statements in functions or methods that have no contract. *)
   option_allow_ignore_ref_creation: bool;
+  option_incremental: bool; (* Skip functions whose verification result is cached in the .vfcache file. *)
+  option_merge_paths: bool; (* Verify conditional statements whose branches only assign simple expressions to local variables by merging the branches' states at the join point (see IfStmt in Verifast). *)
+  option_max_steps_per_function: int option; (* A function whose symbolic execution takes more than this number of execution steps is reported as having exceeded its budget, and verification continues with the next function. *)
+  option_max_prover_seconds_per_function: float option; (* Likewise, for the number of seconds spent in the Redux prover. *)
 } (* ?options *)
 
 (* Region: verify_program_core: the toplevel function *)
@@ -0,0 +1,137 @@
+open Ast
+
+(*
+
+Binary cache of parsed header files.
+
+Parsing the prelude (prelude.h, prelude_core.gh, list.gh) dominates the startup
+time of VeriFast on small files. Therefore, we cache the parse result of these
+headers on disk, in OCaml's marshalling format.
+
+A cache file is named after a digest of the header's path, the identity of the
+VeriFast executable (the layout of the marshalled AST depends on it) and the
+parser configuration (data model, dialect, etc.). It contains:
+- a format version line;
+- the list of (path, digest) pairs of all files that were read while parsing the
+  header, together with the marshalled parse result and the calls the parser
+  made to the range, macro call and should-fail callbacks.
+If any of these files has changed, or the cache file cannot be read, the header
+is parsed again and the cache file is rewritten. Entries are also kept in
+memory, so that subsequent verifications in the same process (in the IDE, or
+in the children of a verification server) need not read the cache file.
+
+The recorded callback calls are replayed on a cache hit, so that clients that
+highlight ranges or check //~ directives (the IDE, -allow_should_fail runs)
+observe the same calls as when the header is parsed.
+
+Only parse results are cached; the type-checked header maps contain prover
+terms, which are valid only for the prover context in which they were created.
+
+The cache is stored in VeriFast's cache directory (see Vfcache).
+
+*)
+
+let format_version = "VeriFast-header-cache 2"
+
+(** Identifies the running executable, without reading it in its entirety. *)
+let executable_identity =
+  lazy begin
+    try
+      let {Unix.st_size; st_mtime} = Unix.stat Sys.executable_name in
+      Printf.sprintf "%s:%d:%.0f" Sys.executable_name st_size st_mtime
+    with Unix.Unix_error _ -> Sys.executable_name
+  end
+
+let digest_of_file path = try Some (Digest.file path) with Sys_error _ -> None
+
+(** The paths of the files read while parsing a header, as recorded in its parse result. *)
+let files_read path (headers, _) =
+  path::List.map (fun (_, (_, _, total_path), _, _) -> total_path) headers
+
+(** Parsing a header registers the typedefs it declares with the parser; a cache
+    hit must have the same effect. *)
+let register_typedefs (headers, ps) =
+  let register_package (PackageDecl (_, _, _, ds)) =
+    ds |> List.iter (function TypedefDecl (_, _, g, _) -> Parser.register_typedef g | _ -> ())
+  in
+  headers |> List.iter (fun (_, _, _, ps) -> List.iter register_package ps);
+  List.iter register_package ps
+
+(** A call of one of the parser's callbacks. *)
+type callback_call =
+  ReportRange of Lexer.range_kind * loc0
+| ReportMacroCall of loc * loc
+| ReportShouldFail of string * loc0
+
+(** [recording_callbacks (reportMacroCall, reportRange, reportShouldFail)]
+    returns callbacks that forward to the given ones and a function that
+    returns the calls made so far, in order. *)
+let recording_callbacks (reportMacroCall, reportRange, reportShouldFail) =
+  let calls = ref [] in
+  let reportMacroCall lu ld = calls := ReportMacroCall (lu, ld)::!calls; reportMacroCall lu ld in
+  let reportRange kind l = calls := ReportRange (kind, l)::!calls; reportRange kind l in
+  let reportShouldFail directive l = calls := ReportShouldFail (directive, l)::!calls; reportShouldFail directive l in
+  ((reportMacroCall, reportRange, reportShouldFail), fun () -> List.rev !calls)
+
+let replay_callbacks (reportMacroCall, reportRange, reportShouldFail) calls =
+  calls |> List.iter begin function
+    ReportRange (kind, l) -> reportRange kind l
+  | ReportMacroCall (lu, ld) -> reportMacroCall lu ld
+  | ReportShouldFail (directive, l) -> reportShouldFail directive l
+  end
+
+let deps_unchanged deps = List.for_all (fun (path, digest) -> digest_of_file path = Some digest) deps
+
+(** Maps each cache key to the digests of the files read while parsing the
+    header and the marshalled parse result. A fresh copy of the AST is
+    unmarshalled for each use, since type checking mutates it. *)
+let in_memory: (string, (string * Digest.t) list * string) Hashtbl.t = Hashtbl.create 4
+
+let try_load cache_name =
+  Vfcache.read_file cache_name begin fun chan ->
+    if input_line chan <> format_version then None else
+    let ((deps, data): (string * Digest.t) list * string) = Marshal.from_channel chan in
+    if deps_unchanged deps then Some (deps, data) else None
+  end
+
+let try_save cache_name entry =
+  Vfcache.write_file cache_name begin fun chan ->
+    output_string chan (format_version ^ "\n");
+    Marshal.to_channel chan entry []
+  end
+
+(** [parse_header_file_cached path config callbacks parse] returns the result of
+    [parse callbacks], which must parse the header file at [path], taking it from
+    the cache if possible. [config] identifies the parser configuration.
+    [callbacks] are the parser's [(reportMacroCall, reportRange, reportShouldFail)]
+    callbacks; on a cache hit, the calls recorded when the header was parsed are
+    replayed on them. *)
+let parse_header_file_cached path config callbacks parse =
+  let key = Digest.to_hex (Digest.string (String.concat "\n" (format_version::Lazy.force executable_identity::path::config))) in
+  let cache_name = key ^ ".vfhc" in
+  let cached_entry =
+    match Hashtbl.find_opt in_memory key with
+      Some (deps, _ as entry) when deps_unchanged deps -> Some entry
+    | _ ->
+      let entry = try_load cache_name in
+      Option.iter (Hashtbl.replace in_memory key) entry;
+      entry
+  in
+  match cached_entry with
+    Some (_, data) ->
+    let (calls, result) = Marshal.from_string data 0 in
+    replay_callbacks callbacks calls;
+    register_typedefs result;
+    result
+  | None ->
+    let (recording_callbacks, recorded_calls) = recording_callbacks callbacks in
+    let result = parse recording_callbacks in
+    let deps = files_read path result |> List.map (fun path -> (path, digest_of_file path)) in
+    begin match List.map (function (path, Some digest) -> (path, digest) | _ -> raise Not_found) deps, Marshal.to_string (recorded_calls (), result) [] with
+      deps, data ->
+      let entry = (deps, data) in
+      Hashtbl.replace in_memory key entry;
+      try_save cache_name entry
+    | exception (Not_found | Invalid_argument _) -> ()
+    end;
+    result
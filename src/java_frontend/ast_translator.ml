@@ -77,6 +77,9 @@ let enforce_annotations : bool ref = ref false
 
 module JavaParser = Parser.Parser (struct let language = Java let enforce_annotations = true let data_model = Some data_model_java end)
 
+(* Shared by all annotation lexers, so that their keyword tables are built only once. *)
+let annotation_keywords = Parser.common_keywords @ Parser.java_keywords
+
 (* this function creates a lexer for each of 
    the annotations and composes them before
    passing the resulting stream to the parser *)
@@ -106,7 +109,7 @@ let parse_pure_decls_core loc used_parser anns lookup =
           let Lexed (srcpos1, _) = translate_location l in
           let annotChar = '*' in (*No nested annotations allowed, so no problem. JDK takes care of annotation char*)
           let (loc, _, token_stream, _, _) =
-            Lexer.make_lexer_core (Parser.common_keywords @ Parser.java_keywords) 
+            Lexer.make_lexer_core annotation_keywords 
                                   Parser.ghost_keywords srcpos1 a !report_range
                                   false true true !report_should_fail annotChar
           in
@@ -127,6 +127,69 @@ let string_of_json json =
   buffer_add_json buf json;
   Buffer.contents buf
 
+(** A streaming JSON writer. It writes a JSON value piece by piece, so that large
+    arrays and objects need not be built in memory first. The output is identical
+    to that of [buffer_add_json]. *)
+type json_writer = {
+  output: string -> unit;
+  mutable needs_comma: bool; (* Whether the next element of the current array or object must be preceded by a comma *)
+  mutable enclosing: bool list (* The needs_comma values of the enclosing arrays and objects *)
+}
+
+let json_writer output = {output; needs_comma = false; enclosing = []}
+let json_writer_of_channel chan = json_writer (output_string chan)
+let json_writer_of_buffer buf = json_writer (Buffer.add_string buf)
+
+let begin_json_element w =
+  if w.needs_comma then w.output ",";
+  w.needs_comma <- true
+
+let begin_json_container w opening =
+  begin_json_element w;
+  w.output opening;
+  w.enclosing <- w.needs_comma::w.enclosing;
+  w.needs_comma <- false
+
+let end_json_container w closing =
+  w.output closing;
+  match w.enclosing with
+    needs_comma::enclosing -> w.needs_comma <- needs_comma; w.enclosing <- enclosing
+  | [] -> failwith "end_json_container: no open array or object"
+
+let begin_json_array w = begin_json_container w "["
+let end_json_array w = end_json_container w "]"
+let begin_json_object w = begin_json_container w "{"
+let end_json_object w = end_json_container w "}"
+
+(** Writes the key of the next property of the current object; the value must be written next. *)
+let write_json_key w k =
+  begin_json_element w;
+  let buf = Buffer.create 32 in
+  buffer_add_json_string buf k;
+  Buffer.add_char buf ':';
+  w.output (Buffer.contents buf);
+  w.needs_comma <- false
+
+(** Writes [json] as the next element of the current array (or as the value of the current property). *)
+let write_json w json =
+  begin_json_element w;
+  let buf = Buffer.create 256 in
+  buffer_add_json buf json;
+  w.output (Buffer.contents buf)
+
+(** Writes an array of the first [max_elems] elements of [xs], converted by [json_of_elem], followed, if [n > 0] elements
+    were left out, by [json_of_omitted n]. *)
+let write_json_array_truncated w max_elems json_of_elem json_of_omitted xs =
+  begin_json_array w;
+  let count = xs |> List.fold_left begin fun count x ->
+      if count < max_elems then write_json w (json_of_elem x);
+      count + 1
+    end 0
+  in
+  let omitted = count - max_elems in
+  if omitted > 0 then write_json w (json_of_omitted omitted);
+  end_json_array w
+
 type json_token_type = LBracket | RBracket | LBrace | RBrace | Comma | Colon | NullToken | True | False | Integer | String | Eof
 
 let string_of_token_type = function
@@ -17,3 +17,46 @@ let () =
     buffer_add_json_pp buf 2 j;
     assert(Buffer.contents buf = "{\n  \"key\": \"value\",\n  \"arr\": {\n    \"nested_arr\": [\n      [\n        null,\n        10,\n        []\n      ],\n      \"string\",\n      true\n    ],\n    \"empty object\": {}\n  }\n}")
   end
+
+(* The streaming writer produces the same output as string_of_json *)
+let () =
+  let rec stream w json =
+    match json with
+      A vs -> begin_json_array w; List.iter (stream w) vs; end_json_array w
+    | O kvs -> begin_json_object w; List.iter (fun (k, v) -> write_json_key w k; stream w v) kvs; end_json_object w
+    | v -> write_json w v
+  in
+  let check json =
+    let buf = Buffer.create 256 in
+    stream (json_writer_of_buffer buf) json;
+    assert(Buffer.contents buf = string_of_json json);
+    (* Writing whole subtrees with write_json gives the same output too *)
+    let buf = Buffer.create 256 in
+    let w = json_writer_of_buffer buf in
+    begin match json with
+      A vs -> begin_json_array w; List.iter (write_json w) vs; end_json_array w
+    | O kvs -> begin_json_object w; List.iter (fun (k, v) -> write_json_key w k; write_json w v) kvs; end_json_object w
+    | v -> write_json w v
+    end;
+    assert(Buffer.contents buf = string_of_json json)
+  in
+  check (A []);
+  check (O []);
+  check (A [A []; O []; A [A [Null]]]);
+  check (O ["a", O ["b", A [I 1; I (-2); B true; B false; Null]; "c", O []]; "d", A [O ["e", S "f"]; A []]]);
+  check (A [S "quote \" backslash \\ newline \n return \r tab \t NUL \x00 unit separator \x1f"; O ["key \"with\" \\escapes\n", S ""]]);
+  check (O ["\xc3\xa9t\xc3\xa9", A [S "\xe2\x82\xac"; S "\xf0\x9f\x8e\x89"; S "\xef\xbf\xbd"]])
+
+(* -json_max_heap_chunks: write_json_array_truncated writes at most the given number of elements, followed by a
+   pseudo-element that reports the number of omitted elements *)
+let () =
+  let write max_elems xs =
+    let buf = Buffer.create 256 in
+    write_json_array_truncated (json_writer_of_buffer buf) max_elems (fun i -> I i) (fun n -> S (Printf.sprintf "%d more" n)) xs;
+    Buffer.contents buf
+  in
+  assert(write max_int [1; 2; 3] = string_of_json (A [I 1; I 2; I 3]));
+  assert(write 3 [1; 2; 3] = string_of_json (A [I 1; I 2; I 3]));
+  assert(write 2 [1; 2; 3] = string_of_json (A [I 1; I 2; S "1 more"]));
+  assert(write 0 [1; 2; 3] = string_of_json (A [S "3 more"]));
+  assert(write 0 [] = "[]")
@@ -43,6 +43,8 @@ let dots = ref false  (* Print only a dot for successfully terminated processes.
 let verbose = ref false
 let main_filename = ref "standard input"
 let main_file = ref stdin
+let history_path = ref None (* File that stores the durations of the commands in previous runs *)
+let timings_json_path = ref None
 
 let () =
   let rec iter args =
@@ -57,6 +59,12 @@ let () =
     | "-verbose"::args ->
       verbose := true;
       iter args
+    | "-history"::path::args ->
+      history_path := Some path;
+      iter args
+    | "-timings_json"::path::args ->
+      timings_json_path := Some path;
+      iter args
     | filename::args when String.length filename > 0 && filename.[0] <> '-' ->
       main_filename := filename;
       let file = try open_in filename with Sys_error s -> failwith (Printf.sprintf "Could not open file '%s': %s" filename s) in
@@ -64,7 +72,7 @@ let () =
       iter args
     | arg::args ->
       Printf.printf "Invalid argument: %s\n" arg;
-      print_endline "Usage: mysh [-cpus n] [-dots] [-verbose] [filename]";
+      print_endline "Usage: mysh [-cpus n] [-dots] [-verbose] [-history path] [-timings_json path] [filename]";
       exit 1
   in
   iter (List.tl (Array.to_list Sys.argv))
@@ -91,29 +99,90 @@ let atomic_counter () =
     Mutex.unlock mutex;
     value
 
-let semaphore initialValue =
-  let count = ref initialValue in
-  let mutex = Mutex.create () in
-  let cond = Condition.create () in
-  let acquire () =
-    Mutex.lock mutex;
-    while !count = 0 do
-      Condition.wait cond mutex
-    done;
-    decr count;
-    Mutex.unlock mutex
-  in
-  let release () =
-    Mutex.lock mutex;
-    incr count;
-    Condition.signal cond;
-    Mutex.unlock mutex
-  in
-  acquire, release
-
 let processes_started_counter = atomic_counter ()
 
-let acquire_run_permission, release_run_permission = semaphore !max_processes
+type job = {job_priority: float; job_seqno: int; job_run: unit -> unit}
+
+(* The commands that are waiting to be run. A fixed pool of !max_processes worker threads runs them, each time
+   taking the waiting command with the highest priority (i.e. the longest expected duration); among commands with
+   equal priority, the one that was submitted first. Since the commands of a parallel block are all submitted
+   before they are run, a slow command near the end of a block, or in a nested block, can start before the fast
+   commands that precede it. *)
+let jobs: job list ref = ref []
+let jobs_mutex = Mutex.create ()
+let job_submitted = Condition.create ()
+let job_counter = atomic_counter ()
+
+let submit_job priority run =
+  let job = {job_priority = priority; job_seqno = job_counter (); job_run = run} in
+  Mutex.lock jobs_mutex;
+  push jobs job;
+  Condition.signal job_submitted;
+  Mutex.unlock jobs_mutex
+
+let rec run_jobs () =
+  Mutex.lock jobs_mutex;
+  while !jobs = [] do
+    Condition.wait job_submitted jobs_mutex
+  done;
+  let better j1 j2 = j1.job_priority > j2.job_priority || j1.job_priority = j2.job_priority && j1.job_seqno < j2.job_seqno in
+  let j::js = !jobs in
+  let best = List.fold_left (fun best j -> if better j best then j else best) j js in
+  jobs := List.filter (fun j -> j != best) !jobs;
+  Mutex.unlock jobs_mutex;
+  best.job_run ();
+  run_jobs ()
+
+let () =
+  for _ = 1 to !max_processes do
+    ignore (Thread.create run_jobs ())
+  done
+
+(* Maps each command (prefixed with its working directory) to its duration in the previous run. *)
+let history: (string, float) Hashtbl.t =
+  let history = Hashtbl.create 1000 in
+  begin match !history_path with
+    Some path when Sys.file_exists path ->
+    let file = open_in path in
+    begin try
+      while true do
+        let line = read_line_canon file in
+        match String.index_opt line '\t' with
+          Some tab ->
+          begin match float_of_string_opt (String.sub line 0 tab) with
+            Some duration -> Hashtbl.replace history (String.sub line (tab + 1) (String.length line - tab - 1)) duration
+          | None -> ()
+          end
+        | None -> ()
+      done
+    with End_of_file -> ()
+    end;
+    close_in file
+  | _ -> ()
+  end;
+  history
+
+(* Commands that have not been run before are started first, since they might be slow. *)
+let expected_duration cmd =
+  match Hashtbl.find_opt history cmd with
+    Some duration -> duration
+  | None -> infinity
+
+type process_info = {
+  proc_cmd: string;
+  proc_pred: process_info option; (* The process whose completion allowed this one to be started *)
+  mutable proc_start: float;
+  mutable proc_finish: float;
+  mutable proc_status: string;
+  mutable proc_success: bool;
+}
+
+let all_processes: process_info list ref = ref []
+
+let later_finish p1 p2 =
+  match p1, p2 with
+    None, p | p, None -> p
+  | Some q1, Some q2 -> if q2.proc_finish > q1.proc_finish then p2 else p1
 
 let failed_processes_log: string list list ref = ref []
 let global_mutex = Mutex.create ()
@@ -132,12 +201,19 @@ let print_endline s =
 
 let with_global_lock body =
   Mutex.lock global_mutex;
-  body ();
-  Mutex.unlock global_mutex
+  Fun.protect ~finally:(fun () -> Mutex.unlock global_mutex) body
 
 let do_print_line s =
   with_global_lock (fun () -> print_endline s)
 
+(* Records that running [desc] raised [e] as a failed command. *)
+let record_exception desc e =
+  with_global_lock begin fun () ->
+    let lines = [Printf.sprintf "FAIL: %s raised %s" desc (Printexc.to_string e)] in
+    print_endline (List.hd lines);
+    push failed_processes_log lines
+  end
+
 type alarm = {mutable alarm_prev: alarm; alarm_time: float; alarm_handler: unit -> unit; mutable alarm_next: alarm}
 
 let remove_alarm alarm =
@@ -268,10 +344,21 @@ let parse_file lines =
 
 let rootdir = Sys.getcwd ()
 
-let rec exec_cmds macros cwd parallel cmds =
+(* Returns the process that finished last among the processes started by [cmds] (and [pred], the process that
+   finished last before [cmds] were started), for the purpose of computing the critical path. *)
+let rec exec_cmds macros cwd parallel pred cmds =
   let macros = ref macros in
   let cwd = ref cwd in
   let cwdStack = ref [] in
+  let last_process = ref pred in
+  let record_result p =
+    if parallel then begin
+      Mutex.lock global_mutex;
+      last_process := later_finish !last_process p;
+      Mutex.unlock global_mutex
+    end else
+      last_process := later_finish !last_process p
+  in
   let getcwd () = !cwd in
   let get_abs_path relpath = rootdir ^ "/" ^ getcwd () ^ "/" ^ relpath in
   let children_started_count = ref 0 in
@@ -296,19 +383,49 @@ let rec exec_cmds macros cwd parallel cmds =
       Mutex.unlock global_mutex;
       ignore $ Thread.create
         begin fun () ->
-          body ();
-          Mutex.lock global_mutex;
-          child_finished ();
-          Mutex.unlock global_mutex
+          begin try body () with e -> record_exception "a parallel block" e end;
+          with_global_lock child_finished
         end
         ()
     end else
       body ()
   in
-  let run_child_cmds parallel cmds =
+  (* Runs [body], which runs process [desc], on one of the worker threads; in a sequential block, waits for it to
+     finish. If [body] raises an exception, it is recorded as a failure; the worker thread carries on. *)
+  let run_process priority desc body =
+    let body () = try body () with e -> record_exception desc e in
+    if parallel then begin
+      Mutex.lock global_mutex;
+      incr children_started_count;
+      Mutex.unlock global_mutex;
+      submit_job priority
+        begin fun () ->
+          body ();
+          with_global_lock child_finished
+        end
+    end else begin
+      let finished = ref false in
+      let finished_cond = Condition.create () in
+      submit_job priority
+        begin fun () ->
+          body ();
+          with_global_lock begin fun () ->
+            finished := true;
+            Condition.signal finished_cond
+          end
+        end;
+      Mutex.lock global_mutex;
+      while not !finished do
+        Condition.wait finished_cond global_mutex
+      done;
+      Mutex.unlock global_mutex
+    end
+  in
+  let run_child_cmds parallel' cmds =
     let macros = !macros in
     let cwd = !cwd in
-    run_child (fun () -> exec_cmds macros cwd parallel cmds)
+    let pred = if parallel then pred else !last_process in
+    run_child (fun () -> record_result (exec_cmds macros cwd parallel' pred cmds))
   in
   let rec exec_cmds0 cmds =
   if parallel || !failed_processes_log = [] then
@@ -377,47 +494,50 @@ let rec exec_cmds macros cwd parallel cmds =
       | [cmdName; args] when List.mem_assoc cmdName !macros ->
         List.iter (fun line -> exec_line (Printf.sprintf "%s %s" line args)) (List.assoc cmdName !macros)
       | _ ->
-        acquire_run_permission ();
-        let pid = processes_started_counter () in
-        if !verbose then do_print_line (Printf.sprintf "Starting process %d" pid);
-        let time0 = Unix.gettimeofday () in
         let cwd = getcwd () in
+        let abs_cwd = get_abs_path "." in
         let line' = if cwd = "." then line else cwd ^ "$ " ^ line in
-        Mutex.lock global_mutex;
-        Sys.chdir (get_abs_path ".");
-        let negate_exit_status, line =
-          if line <> "" && line.[0] = '!' then
-            true, String.sub line 1 (String.length line - 1)
-          else
-            false, line
-        in
-        let expected_output, line =
-          let r = Str.regexp {|\[ "\$(\([^)]*\))" = \$'\([^']*\)' ]$|} in
-          if Str.string_match r line 0 then
-            let expected_output = Str.matched_group 2 line in
-            let line = Str.matched_group 1 line in
-            let expected_output = Str.global_replace (Str.regexp_string "\\n") "\n" expected_output in
-            Some expected_output, line
-          else
-            None, line
-        in
-        let cin = Unix.open_process_in (line ^ " 2>&1") in
-        Mutex.unlock global_mutex;
-        let current_alarm = ref None in
-        let rec produce_alarm i =
-          let runtime = i * 5 in
-          let alarm = create_alarm (time0 +. float_of_int runtime) begin fun () ->
-              Mutex.lock global_mutex;
-              print_endline (Printf.sprintf "SLOW: %s has been running for %ds" line' runtime);
-              produce_alarm (i + 1);
-              Mutex.unlock global_mutex
-            end
-          in
-          current_alarm := Some alarm
-        in
-        produce_alarm 1;
-        run_child
+        let proc = {proc_cmd = line'; proc_pred = (if parallel then pred else !last_process); proc_start = 0.0; proc_finish = 0.0; proc_status = ""; proc_success = false} in
+        run_process (expected_duration line') line'
           begin fun () ->
+            let pid = processes_started_counter () in
+            if !verbose then do_print_line (Printf.sprintf "Starting process %d" pid);
+            let time0 = Unix.gettimeofday () in
+            let negate_exit_status, line =
+              if line <> "" && line.[0] = '!' then
+                true, String.sub line 1 (String.length line - 1)
+              else
+                false, line
+            in
+            let expected_output, line =
+              let r = Str.regexp {|\[ "\$(\([^)]*\))" = \$'\([^']*\)' ]$|} in
+              if Str.string_match r line 0 then
+                let expected_output = Str.matched_group 2 line in
+                let line = Str.matched_group 1 line in
+                let expected_output = Str.global_replace (Str.regexp_string "\\n") "\n" expected_output in
+                Some expected_output, line
+              else
+                None, line
+            in
+            let cin =
+              with_global_lock begin fun () ->
+                Sys.chdir abs_cwd;
+                Unix.open_process_in (line ^ " 2>&1")
+              end
+            in
+            let current_alarm = ref None in
+            let rec produce_alarm i =
+              let runtime = i * 5 in
+              let alarm = create_alarm (time0 +. float_of_int runtime) begin fun () ->
+                  with_global_lock begin fun () ->
+                    print_endline (Printf.sprintf "SLOW: %s has been running for %ds" line' runtime);
+                    produce_alarm (i + 1)
+                  end
+                end
+              in
+              current_alarm := Some alarm
+            in
+            produce_alarm 1;
             let output = ref [] in
             if !verbose then push output line';
             try
@@ -434,11 +554,14 @@ let rec exec_cmds macros cwd parallel cmds =
               done
             with End_of_file -> ();
             let status = Unix.close_process_in cin in
-            Mutex.lock global_mutex;
+            with_global_lock begin fun () ->
             let time1 = Unix.gettimeofday() in
             if !verbose then print_endline (Printf.sprintf "[%d]%f seconds\n" pid (time1 -. time0));
             let Some alarm = !current_alarm in
             cancel_alarm alarm;
+            proc.proc_start <- time0;
+            proc.proc_finish <- time1;
+            proc.proc_status <- string_of_status status;
             let success =
               match expected_output with
                 None ->
@@ -467,8 +590,10 @@ let rec exec_cmds macros cwd parallel cmds =
               else
                 print_endline (Printf.sprintf "PASS: %s (%.2fs)" line' (time1 -. time0))
             end;
-            Mutex.unlock global_mutex;
-            release_run_permission ()
+            proc.proc_success <- success;
+            push all_processes proc
+            end;
+            record_result (Some proc)
           end
       in
       exec_line line
@@ -478,15 +603,64 @@ let rec exec_cmds macros cwd parallel cmds =
     exec_cmds0 cmds
   in
   exec_cmds0 cmds;
-  join_children ()
+  join_children ();
+  !last_process
+
+let json_of_string s =
+  let buf = Buffer.create (String.length s + 2) in
+  Buffer.add_char buf '"';
+  s |> String.iter begin function
+      '"' -> Buffer.add_string buf "\\\""
+    | '\\' -> Buffer.add_string buf "\\\\"
+    | c when c < ' ' -> Printf.bprintf buf "\\u%04x" (Char.code c)
+    | c -> Buffer.add_char buf c
+  end;
+  Buffer.add_char buf '"';
+  Buffer.contents buf
+
+let save_history () =
+  match !history_path with
+    None -> ()
+  | Some path ->
+    !all_processes |> List.iter (fun p -> Hashtbl.replace history p.proc_cmd (p.proc_finish -. p.proc_start));
+    let file = open_out path in
+    history |> Hashtbl.iter (fun cmd duration -> Printf.fprintf file "%f\t%s\n" duration cmd);
+    close_out file
+
+let write_timings_json time0 time1 critical_path =
+  match !timings_json_path with
+    None -> ()
+  | Some path ->
+    let file = open_out path in
+    let json_of_process p =
+      Printf.sprintf "{\"command\": %s, \"start\": %.3f, \"duration\": %.3f, \"status\": %s, \"success\": %B}"
+        (json_of_string p.proc_cmd) (p.proc_start -. time0) (p.proc_finish -. p.proc_start) (json_of_string p.proc_status) p.proc_success
+    in
+    let json_of_processes ps = "[\n    " ^ String.concat ",\n    " (List.map json_of_process ps) ^ "\n  ]" in
+    let processes = List.sort (fun p1 p2 -> compare p1.proc_start p2.proc_start) !all_processes in
+    Printf.fprintf file "{\n  \"cpus\": %d,\n  \"total_time\": %.3f,\n  \"processes\": %s,\n  \"critical_path\": %s\n}\n"
+      !max_processes (time1 -. time0) (json_of_processes processes) (json_of_processes critical_path);
+    close_out file
 
 let () =
   let time0 = Unix.gettimeofday() in
   let lines = read_file_lines !main_filename !main_file in
   let cmds = parse_file lines in
-  exec_cmds [] "." false cmds;
+  let last_process = exec_cmds [] "." false None cmds in
   let time1 = Unix.gettimeofday() in
   Printf.printf "Total execution time: %f seconds\n" (time1 -. time0);
+  let critical_path =
+    let rec iter p path = match p with None -> path | Some p -> iter p.proc_pred (p::path) in
+    iter last_process []
+  in
+  if critical_path <> [] then begin
+    let duration p = p.proc_finish -. p.proc_start in
+    Printf.printf "Critical path: %d processes, %f seconds\n" (List.length critical_path) (List.fold_left (fun t p -> t +. duration p) 0.0 critical_path);
+    let slowest = List.sort (fun p1 p2 -> compare (duration p2) (duration p1)) critical_path |> List.filteri (fun i _ -> i < 5) in
+    slowest |> List.iter (fun p -> Printf.printf "  %8.2fs %s\n" (duration p) p.proc_cmd)
+  end;
+  save_history ();
+  write_timings_json time0 time1 critical_path;
   List.rev !failed_processes_log |> List.iter begin fun lines ->
     print_newline ();
     List.iter print_endline lines
@@ -0,0 +1,86 @@
+(*
+
+Hot-path profiler (command-line option -profile).
+
+Attributes verification cost to symbolic execution stacks. The stack of an
+execution step consists of the message of its outermost context frame (e.g.
+"Verifying function 'main'"), followed by the source line of the innermost
+step at each subcontext level: the line of a statement of the function being
+verified, then, if the step is part of e.g. a function call, lemma call, or
+predicate opening, the line of the callee's contract or the predicate's body,
+and so on.
+
+For each stack, we record
+- the wall-clock time spent while it was the current stack;
+- the time spent in Redux (as measured by Redux.stopwatch);
+- the number of symbolic execution forks;
+- the number of attempts to match a heap chunk.
+Each of these is written to a separate file (PREFIX.wall.folded,
+PREFIX.prover.folded, PREFIX.branches.folded, PREFIX.chunk_matches.folded)
+in the "collapsed stack" format understood by flamegraph tools: one line
+per stack, consisting of the frames separated by semicolons, a space, and
+the count. Times are written in microseconds.
+
+*)
+
+type sample = {
+  mutable wall: float;
+  mutable prover_ticks: int64;
+  mutable branches: int;
+  mutable chunk_matches: int
+}
+
+let enabled = ref false
+
+let samples: (string, sample) Hashtbl.t = Hashtbl.create 1000
+
+let new_sample () = {wall = 0.0; prover_ticks = 0L; branches = 0; chunk_matches = 0}
+
+let current_sample = ref (new_sample ())
+let last_time = ref 0.0
+let last_prover_ticks = ref 0L
+
+(** Charges the cost since the previous call to the current stack. *)
+let charge () =
+  let time = Perf.time () in
+  let prover_ticks = Stopwatch.ticks Redux.stopwatch in
+  let sample = !current_sample in
+  sample.wall <- sample.wall +. (time -. !last_time);
+  sample.prover_ticks <- Int64.add sample.prover_ticks (Int64.sub prover_ticks !last_prover_ticks);
+  last_time := time;
+  last_prover_ticks := prover_ticks
+
+(** Charges the cost since the previous call to the current stack and makes [stack] the current stack. *)
+let switch_to stack =
+  charge ();
+  current_sample :=
+    match Hashtbl.find_opt samples stack with
+      Some sample -> sample
+    | None -> let sample = new_sample () in Hashtbl.add samples stack sample; sample
+
+let branch () = let sample = !current_sample in sample.branches <- sample.branches + 1
+
+let chunk_match () = let sample = !current_sample in sample.chunk_matches <- sample.chunk_matches + 1
+
+let write_profile prefix =
+  let tickLength = (!Stats.stats)#tickLength in
+  let write suffix value =
+    let chan = open_out (prefix ^ suffix) in
+    samples |> Hashtbl.iter begin fun stack sample ->
+      let value = value sample in
+      if value > 0 then Printf.fprintf chan "%s %d\n" stack value
+    end;
+    close_out chan
+  in
+  write ".wall.folded" (fun sample -> int_of_float (sample.wall *. 1e6));
+  write ".prover.folded" (fun sample -> int_of_float (Int64.to_float sample.prover_ticks *. tickLength *. 1e6));
+  write ".branches.folded" (fun sample -> sample.branches);
+  write ".chunk_matches.folded" (fun sample -> sample.chunk_matches)
+
+(** Enables the profiler; the profile is written when the process exits, or
+    by the action registered with [at_exit], if given. *)
+let start ?(at_exit = at_exit) prefix =
+  enabled := true;
+  last_time := Perf.time ();
+  last_prover_ticks := Stopwatch.ticks Redux.stopwatch;
+  at_exit (fun () -> charge (); write_profile prefix)
@@ -101,9 +101,179 @@ class virtual ['typenode, 'symbol, 'termnode] context =
     method virtual assume: 'termnode -> assume_result
     method virtual query: 'termnode -> bool
     method virtual stats: string * (string * int64) list
+    method virtual counters: (string * int) list (* The prover's internal counters, for -stats_json *)
     method virtual begin_formal: unit
     method virtual end_formal: unit
     method virtual mk_bound: int -> 'typenode -> 'termnode
     method virtual assume_forall: string (* description for diagnostic traces *) -> 'termnode list -> ('typenode) list -> 'termnode -> unit
     method virtual simplify: 'termnode -> 'termnode option
   end
+
+(*
+
+Query result cache.
+
+Symbolic execution frequently asks the prover the same question under the same
+path condition, e.g. when matching a chunk pattern against many candidate
+chunks, or when re-checking the same bounds. The caching context below wraps
+a prover context and remembers query results per assumption context.
+
+Each assume, assert_term, assume_forall or set_fpclauses call starts a new
+generation; cached results are keyed on the generation as well as the query
+term, so they simply stop matching once the assumptions change. A push keeps
+the generation, and a pop restores the one that was current at the matching
+push, so results cached before a push-pop pair hit again after it. This
+matters because symbolic execution pushes and pops around every branch.
+
+Query terms are identified by physical identity. To make repeated queries
+hit, the binary relational constructors (mk_eq, mk_iff, mk_le, ...) and mk_not
+are hash-consed on the physical identity of their operands, so that e.g.
+[ctxt#query (ctxt#mk_eq t1 t2)] yields the same query term each time it is
+called with the same [t1] and [t2].
+
+Terms are hashed with [Hashtbl.hash], which looks only at a bounded prefix of
+the term and never fails; equality is always physical equality, so the cache
+is correct for any prover's term representation.
+
+*)
+
+(* Maps (generation, key) pairs to values; keys are compared physically. *)
+module PhysTable : sig
+  type ('k, 'v) t
+  val create: int -> ('k, 'v) t
+  val find_opt: ('k, 'v) t -> int -> 'k -> 'v option
+  val add: ('k, 'v) t -> int -> 'k -> 'v -> unit
+end = struct
+  type ('k, 'v) t = {table: (int, int * 'k * 'v) Hashtbl.t; capacity: int}
+  let create capacity = {table = Hashtbl.create 251; capacity}
+  let hash g k = Hashtbl.hash (g, Hashtbl.hash k)
+  let find_opt {table} g k =
+    let rec iter entries =
+      match entries with
+        [] -> None
+      | (g', k', v)::entries -> if g' = g && k' == k then Some v else iter entries
+    in
+    iter (Hashtbl.find_all table (hash g k))
+  let add {table; capacity} g k v =
+    (* Keep the table bounded; entries are cheap to recompute. *)
+    if Hashtbl.length table >= capacity then Hashtbl.reset table;
+    Hashtbl.add table (hash g k) (g, k, v)
+end
+
+type binop_tag = EqOp | IffOp | LeOp | LtOp | RealLeOp | RealLtOp | NotOp
+
+class ['typenode, 'symbol, 'termnode] caching_context (ctxt: ('typenode, 'symbol, 'termnode) context) =
+  object (self)
+    inherit ['typenode, 'symbol, 'termnode] context
+
+    val terms: (int, binop_tag * 'termnode * 'termnode * 'termnode) Hashtbl.t = Hashtbl.create 251
+    val results: ('termnode, bool) PhysTable.t = PhysTable.create 1024
+    val mutable hits = 0
+    val mutable misses = 0
+    val mutable invalidations = 0
+    val mutable generation = 0
+    val mutable next_generation = 1
+    val mutable saved_generations = []
+
+    (** Called whenever the set of assumptions changes other than by a pop.
+        Results cached under the old generation no longer match. *)
+    method private new_generation =
+      invalidations <- invalidations + 1;
+      generation <- next_generation;
+      next_generation <- next_generation + 1
+
+    (** Identifies the current set of assumptions: two calls return the same
+        number only if no assumptions were added in between, except in
+        push-pop pairs. *)
+    method state_generation = generation
+
+    method private hashcons tag t1 t2 mk =
+      (* The operands are compared by physical identity. *)
+      let h = Hashtbl.hash (tag, t1, t2) in
+      let rec find entries =
+        match entries with
+          [] -> None
+        | (tag', t1', t2', t)::entries -> if tag' = tag && t1' == t1 && t2' == t2 then Some t else find entries
+      in
+      match find (Hashtbl.find_all terms h) with
+        Some t -> t
+      | None ->
+        let t = mk () in
+        if Hashtbl.length terms >= 4096 then Hashtbl.reset terms;
+        Hashtbl.add terms h (tag, t1, t2, t);
+        t
+
+    method set_verbosity v = ctxt#set_verbosity v
+    method type_bool = ctxt#type_bool
+    method type_int = ctxt#type_int
+    method type_real = ctxt#type_real
+    method type_inductive = ctxt#type_inductive
+    method mk_boxed_int t = ctxt#mk_boxed_int t
+    method mk_unboxed_int t = ctxt#mk_unboxed_int t
+    method mk_boxed_real t = ctxt#mk_boxed_real t
+    method mk_unboxed_real t = ctxt#mk_unboxed_real t
+    method mk_boxed_bool t = ctxt#mk_boxed_bool t
+    method mk_unboxed_bool t = ctxt#mk_unboxed_bool t
+    method mk_symbol name domain range kind = ctxt#mk_symbol name domain range kind
+    method set_fpclauses s k cs = self#new_generation; ctxt#set_fpclauses s k cs
+    method mk_app s ts = ctxt#mk_app s ts
+    method mk_true = ctxt#mk_true
+    method mk_false = ctxt#mk_false
+    method mk_and t1 t2 = ctxt#mk_and t1 t2
+    method mk_or t1 t2 = ctxt#mk_or t1 t2
+    method mk_not t = self#hashcons NotOp t t (fun () -> ctxt#mk_not t)
+    method mk_ifthenelse t1 t2 t3 = ctxt#mk_ifthenelse t1 t2 t3
+    method mk_iff t1 t2 = self#hashcons IffOp t1 t2 (fun () -> ctxt#mk_iff t1 t2)
+    method mk_implies t1 t2 = ctxt#mk_implies t1 t2
+    method mk_eq t1 t2 = self#hashcons EqOp t1 t2 (fun () -> ctxt#mk_eq t1 t2)
+    method mk_intlit n = ctxt#mk_intlit n
+    method mk_intlit_of_string s = ctxt#mk_intlit_of_string s
+    method mk_add t1 t2 = ctxt#mk_add t1 t2
+    method mk_sub t1 t2 = ctxt#mk_sub t1 t2
+    method mk_mul t1 t2 = ctxt#mk_mul t1 t2
+    method mk_div t1 t2 = ctxt#mk_div t1 t2
+    method mk_mod t1 t2 = ctxt#mk_mod t1 t2
+    method mk_lt t1 t2 = self#hashcons LtOp t1 t2 (fun () -> ctxt#mk_lt t1 t2)
+    method mk_le t1 t2 = self#hashcons LeOp t1 t2 (fun () -> ctxt#mk_le t1 t2)
+    method mk_reallit n = ctxt#mk_reallit n
+    method mk_reallit_of_num n = ctxt#mk_reallit_of_num n
+    method mk_real_add t1 t2 = ctxt#mk_real_add t1 t2
+    method mk_real_sub t1 t2 = ctxt#mk_real_sub t1 t2
+    method mk_real_mul t1 t2 = ctxt#mk_real_mul t1 t2
+    method mk_real_lt t1 t2 = self#hashcons RealLtOp t1 t2 (fun () -> ctxt#mk_real_lt t1 t2)
+    method mk_real_le t1 t2 = self#hashcons RealLeOp t1 t2 (fun () -> ctxt#mk_real_le t1 t2)
+    method pprint t = ctxt#pprint t
+    method pprint_sort s = ctxt#pprint_sort s
+    method pprint_sym s = ctxt#pprint_sym s
+    method push = saved_generations <- generation::saved_generations; ctxt#push
+    method pop =
+      begin match saved_generations with
+        g::gs -> generation <- g; saved_generations <- gs
+      | [] -> self#new_generation
+      end;
+      ctxt#pop
+    method assert_term t = self#new_generation; ctxt#assert_term t
+    method assume t = self#new_generation; ctxt#assume t
+    method query t =
+      match PhysTable.find_opt results generation t with
+        Some result -> hits <- hits + 1; result
+      | None ->
+        misses <- misses + 1;
+        let result = ctxt#query t in
+        PhysTable.add results generation t result;
+        result
+    method stats =
+      let (text, tickCounts) = ctxt#stats in
+      let queries = hits + misses in
+      let hitRate = if queries = 0 then 0.0 else float_of_int hits *. 100.0 /. float_of_int queries in
+      let cacheText =
+        Printf.sprintf "Query cache: %d hits, %d misses (hit rate %.1f%%), %d invalidations\n" hits misses hitRate invalidations
+      in
+      (text ^ cacheText, tickCounts)
+    method counters = ctxt#counters @ ["query_cache_hits", hits; "query_cache_misses", misses; "query_cache_invalidations", invalidations]
+    method begin_formal = ctxt#begin_formal
+    method end_formal = ctxt#end_formal
+    method mk_bound i tp = ctxt#mk_bound i tp
+    method assume_forall description pats tps body = self#new_generation; ctxt#assume_forall description pats tps body
+    method simplify t = ctxt#simplify t
+  end
@@ -892,6 +892,18 @@ and context () =
         axiomTriggerCounts
       in
         (text, ["Time spent in query, assume, push, pop", Stopwatch.ticks stopwatch; "Time spent in Simplex", simplex#get_ticks])
+
+    method counters =
+      [
+        "assume_core_count", assume_core_count;
+        "case_splits", split_count;
+        "simplex_assert_ge_count", simplex_assert_ge_count;
+        "simplex_assert_eq_count", simplex_assert_eq_count;
+        "simplex_assert_neq_count", simplex_assert_neq_count;
+        "max_truenode_childcount", max_truenode_childcount;
+        "max_falsenode_childcount", max_falsenode_childcount
+      ] @
+      (axioms |> List.filter (fun (k, v) -> !v > 0) |> List.map (fun (k, v) -> ("axiom_triggered:" ^ k, !v)))
     
     initializer
       let eq_listener u1 u2 =
@@ -1,3 +1,5 @@
 let register_provers () =
   VerifastPluginRedux.register_plugin ();
-  VerifastPluginZ3v4dot5.register_plugin ()
+  VerifastPluginZ3v4dot5.register_plugin ();
+  (* Racing relies on Unix.select on a pipe, which Windows does not support. *)
+  if Sys.os_type <> "Win32" then VerifastPluginReduxExtZ3Race.register_plugin ()
@@ -10,6 +10,69 @@ module type RUST_FE_ARGS = sig
   val ignore_unwind_paths : bool
 end
 
+(* Toolchain discovery runs rustc to find the toolchain's sysroot and scans the toolchain's library
+   directory for the rustc driver. The results are cached in memory and in VeriFast's cache directory,
+   keyed by the toolchain name, and are validated against the modification times of the sysroot and the
+   library directory. *)
+module RustTChainCache = struct
+  let format_version = "VeriFast-rust-toolchain-cache 1"
+
+  type entry = {
+    sysroot: string;
+    sysroot_mtime: float;
+    lib_dir: string;
+    lib_mtime: float;
+    rustc_driver_present: bool;
+  }
+
+  let entries: (string, entry) Hashtbl.t = Hashtbl.create 1
+
+  let mtime path = try Some (Unix.stat path).Unix.st_mtime with Unix.Unix_error _ -> None
+
+  let is_valid entry =
+    mtime entry.sysroot = Some entry.sysroot_mtime && mtime entry.lib_dir = Some entry.lib_mtime
+
+  let cache_name tchain_name =
+    let rustup_home = Option.value ~default:"" (Sys.getenv_opt "RUSTUP_HOME") in
+    "rust-toolchain-" ^ Digest.to_hex (Digest.string (tchain_name ^ "\n" ^ rustup_home)) ^ ".vftc"
+
+  (** [find tchain_name compute] returns the cached entry for toolchain [tchain_name], or the result of [compute ()]. *)
+  let find tchain_name compute =
+    match Hashtbl.find_opt entries tchain_name with
+      Some entry when is_valid entry -> Ok entry
+    | _ ->
+      let cache_name = cache_name tchain_name in
+      let cached_entry =
+        Vfcache.read_file cache_name begin fun chan ->
+          if input_line chan <> format_version then None else
+          let (entry: entry) = Marshal.from_channel chan in
+          if is_valid entry then Some entry else None
+        end
+      in
+      let result =
+        match cached_entry with
+          Some entry -> Ok entry
+        | None ->
+          let result = compute () in
+          begin match result with
+            Ok entry ->
+            Vfcache.write_file cache_name begin fun chan ->
+              output_string chan (format_version ^ "\n");
+              Marshal.to_channel chan (entry: entry) []
+            end
+          | Error _ -> ()
+          end;
+          result
+      in
+      begin match result with Ok entry -> Hashtbl.replace entries tchain_name entry | Error _ -> () end;
+      result
+end
+
+(* The long-lived vf-rust-mir-exporter process used if Verifast0.persistent_rust_exporter is set: the
+   executable and environment it was started with, its channels, and the read context for its stdout. *)
+let exporter_server = ref None
+let exporter_server_mutex = Mutex.create ()
+
 module Make (Args : RUST_FE_ARGS) = struct
   open Ocaml_aux
   module VfMirTr = Vf_mir_translator.Make (Args)
@@ -60,6 +123,22 @@ module Make (Args : RUST_FE_ARGS) = struct
 
     let find_tchain_root tchain_name = find_tchain_path tchain_name Root
     let find_tchain_lib tchain_name = find_tchain_path tchain_name Lib
+
+    (** Returns the sysroot and the library directory of the toolchain, and whether the rustc driver is installed. *)
+    let find_tchain tchain_name =
+      RustTChainCache.find tchain_name begin fun () ->
+        let* sysroot = find_tchain_root tchain_name in
+        let lib_dir, rustc_driver_prefix =
+          match Vfconfig.platform with
+          | Windows -> sysroot ^ "/bin", "rustc_driver-"
+          | _ -> sysroot ^ "/lib", "librustc_driver-"
+        in
+        let rustc_driver_present = Array.exists (String.starts_with ~prefix:rustc_driver_prefix) (Sys.readdir lib_dir) in
+        match RustTChainCache.mtime sysroot, RustTChainCache.mtime lib_dir with
+          Some sysroot_mtime, Some lib_mtime ->
+          Ok RustTChainCache.{sysroot; sysroot_mtime; lib_dir; lib_mtime; rustc_driver_present}
+        | _ -> Error (`SysCallFailed ("Could not access toolchain directory " ^ lib_dir))
+      end
   end
 
   let add_path_to_env_var env var_name path =
@@ -98,25 +177,31 @@ module Make (Args : RUST_FE_ARGS) = struct
       let env = env @ [ entry ] in
       Ok (Array.of_list env)
 
+  (** Returns the path, the arguments and the environment for running the exporter on [rs_file_path]. *)
+  let vf_mir_exporter_command (rustc_args : string list) (rs_file_path : string) =
+    (*** TODO @Nima: Get these names from build system *)
+    let tchain_name = "nightly-2025-09-18" in
+    let* RustTChainCache.{sysroot; lib_dir; rustc_driver_present; _} = RustTChain.find_tchain tchain_name in
+    let bin_name = "vf-rust-mir-exporter" in
+    let bin_dir = Filename.dirname Sys.executable_name in
+    let bin_path = bin_dir ^ "/" ^ bin_name in
+    if not rustc_driver_present then
+      Error (`RustcDriverMissing tchain_name)
+    else
+    (* The exporter caches the results of preprocessing source files in VeriFast's cache directory *)
+    let cache_dir_args =
+      match Lazy.force Vfcache.cache_dir with
+        None -> []
+      | Some dir -> ["--vf-rust-mir-exporter:cache-dir=" ^ dir]
+    in
+    let args = Array.of_list ([bin_path; rs_file_path; "--sysroot=" ^ sysroot] @ cache_dir_args @ rustc_args) in
+    let current_env = Unix.environment () in
+    let* env = add_path_to_env_var current_env (match Vfconfig.platform with MacOS -> "DYLD_LIBRARY_PATH" | Windows -> "PATH" | _ -> "LD_LIBRARY_PATH") lib_dir in
+    Ok (bin_path, args, env)
+
   let run_vf_mir_exporter (rustc_args : string list) (rs_file_path : string) =
     try
-      (*** TODO @Nima: Get these names from build system *)
-      let tchain_name = "nightly-2025-09-18" in
-      let* tchain_root = RustTChain.find_tchain_root tchain_name in
-      let tchain_lib, rustc_driver_prefix =
-        match Vfconfig.platform with
-        | Windows -> tchain_root ^ "/bin", "rustc_driver-"
-        | _ -> tchain_root ^ "/lib", "librustc_driver-"
-      in
-      let bin_name = "vf-rust-mir-exporter" in
-      let bin_dir = Filename.dirname Sys.executable_name in
-      let bin_path = bin_dir ^ "/" ^ bin_name in
-      if not (Array.exists (String.starts_with ~prefix:rustc_driver_prefix) (Sys.readdir tchain_lib)) then
-        Error (`RustcDriverMissing tchain_name)
-      else
-      let args = Array.of_list ([bin_path; rs_file_path; "--sysroot=" ^ tchain_root] @ rustc_args) in
-      let current_env = Unix.environment () in
-      let* env = add_path_to_env_var current_env (match Vfconfig.platform with MacOS -> "DYLD_LIBRARY_PATH" | Windows -> "PATH" | _ -> "LD_LIBRARY_PATH") tchain_lib in
+      let* bin_path, args, env = vf_mir_exporter_command rustc_args rs_file_path in
       (* Printf.eprintf "Running %s with arguments %s\n" bin_path (String.concat " " (List.map (Printf.sprintf "'%s'") (Array.to_list args)));
       flush stderr; *)
       let chns = Unix.open_process_args_full bin_path args env in
@@ -127,105 +212,252 @@ module Make (Args : RUST_FE_ARGS) = struct
         let emsg = SysUtil.gen_unix_error_msg ecode fname param in
         Error (`SysCallFailed emsg)
 
-  let get_vf_mir_rd (rustc_args : string list) (rs_file_path : string) =
+  let stop_exporter_server () =
+    match !exporter_server with
+      None -> None
+    | Some (_, chns, _) ->
+      exporter_server := None;
+      try Some (Unix.close_process_full chns) with Unix.Unix_error _ -> None
+
+  (** Sends a request to the persistent exporter (see run_server in the exporter), starting it if necessary.
+      Returns the VF MIR message, a function that reads the next streamed message, and a function that
+      is to be called when the caller is done reading. *)
+  let get_vf_mir_msgs_from_server (rustc_args : string list) (rs_file_path : string) =
+    let module CpIO = Capnp_unix.IO in
+    try
+      let* bin_path, args, env = vf_mir_exporter_command rustc_args rs_file_path in
+      Mutex.lock exporter_server_mutex;
+      let release () = Mutex.unlock exporter_server_mutex; Ok () in
+      let result =
+        try
+          let key = bin_path::Array.to_list env in
+          let (_, (_, out_chn, err_in_chn), msg_rd_ctx) =
+            match !exporter_server with
+              Some (key', _, _ as server) when key' = key -> server
+            | _ ->
+              ignore (stop_exporter_server ());
+              (* If the exporter dies, writing a request should fail with an exception rather than kill VeriFast. *)
+              if Sys.os_type <> "Win32" then Sys.set_signal Sys.sigpipe Sys.Signal_ignore;
+              let msg_in_chn, _, _ as chns = Unix.open_process_args_full bin_path [| bin_path; "--vf-rust-mir-exporter:server" |] env in
+              let server = (key, chns, CpIO.create_read_context_for_channel ~compression:`None msg_in_chn) in
+              exporter_server := Some server;
+              server
+          in
+          output_string out_chn (String.concat "\t" (Sys.getcwd ()::Array.to_list args) ^ "\n");
+          flush out_chn;
+          let marker = "vf-rust-mir-exporter: exit " in
+          let rec read_emsgs lines =
+            match input_line err_in_chn with
+              line when String.starts_with ~prefix:marker line ->
+              let exit_code = int_of_string (String.sub line (String.length marker) (String.length line - String.length marker)) in
+              (Some exit_code, String.concat "\n" (List.rev lines))
+            | line -> read_emsgs (line::lines)
+            | exception End_of_file -> (None, String.concat "\n" (List.rev lines))
+          in
+          let read_message () =
+            match CpIO.ReadContext.read_message msg_rd_ctx with
+              None -> ignore (stop_exporter_server ()); None
+            | Some msg -> Some msg
+            | exception CpIO.Unsupported_message_frame -> ignore (stop_exporter_server ()); None
+          in
+          match read_emsgs [] with
+            Some 0, emsgs ->
+            if List.mem "rust_exporter" Args.verbose_flags then print_endline emsgs;
+            begin match read_message () with
+              Some msg -> Ok (msg, read_message, release)
+            | None -> Error (`RustMirDesFailed "No message from Rust MIR exporter")
+            end
+          | Some exit_code, emsgs -> Error (`RustMirExpFailed (Unix.WEXITED exit_code, emsgs))
+          | None, emsgs ->
+            (* The exporter died *)
+            match stop_exporter_server () with
+              Some result -> Error (`RustMirExpFailed (result, emsgs))
+            | None -> Error (`ProcessFailed bin_path)
+        with e -> ignore (stop_exporter_server ()); ignore (release ()); raise e
+      in
+      begin match result with Error _ -> ignore (release ()) | Ok _ -> () end;
+      result
+    with
+    | Sys_error emsg -> Error (`SysCallFailed emsg)
+    | Unix.Unix_error (ecode, fname, param) ->
+        let emsg = SysUtil.gen_unix_error_msg ecode fname param in
+        Error (`SysCallFailed emsg)
+
+  (** Runs the exporter in a new process. Returns the VF MIR message, a function that reads the next streamed
+      message, and a function that is to be called when the caller is done reading, which waits for the
+      exporter to terminate. *)
+  let get_vf_mir_msgs (rustc_args : string list) (rs_file_path : string) =
     let* msg_in_chn, out_chn, err_in_chn = run_vf_mir_exporter rustc_args rs_file_path in
     let module CpIO = Capnp_unix.IO in
     let msg_rd_ctx =
       CpIO.create_read_context_for_channel ~compression:`None msg_in_chn
     in
-    let rec read_vf_mir_exp_msgs msgs =
-      try
-        match CpIO.ReadContext.read_message msg_rd_ctx with
-        | None -> Ok msgs
-        | Some msg_rw -> read_vf_mir_exp_msgs (msgs @ [ msg_rw ])
-      with
-      | CpIO.Unsupported_message_frame ->
-          Error (`CapnpMsgReadingFailed "Unsupported message frame")
-      | _ -> Error (`CapnpMsgReadingFailed "Unsupported exception")
-    in
-    let rd_ths_res = ref ((*msg reader*) None, (*err reader*) None) in
-    let rd_ths_mtx = Mutex.create () in
-    let rd_ths_cond = Condition.create () in
-    let msg_rd_job _ =
-      let res = read_vf_mir_exp_msgs [] in
-      Mutex.lock rd_ths_mtx;
-      (match res with
-      | Ok msgs -> rd_ths_res := (Some (Ok msgs), snd !rd_ths_res)
-      | Error err -> rd_ths_res := (Some (Error err), snd !rd_ths_res));
-      Condition.broadcast rd_ths_cond;
-      Mutex.unlock rd_ths_mtx
-    in
+    (* The exporter's stderr is read by a separate thread, so that the exporter does not block on it while
+       we are consuming its messages. *)
+    let emsgs = ref None in
     let err_rd_job _ =
-      let emsgs =
-        try Ok (Util.input_fully err_in_chn)
-        with _ -> Error (`ErrMsgReadingFailed "Unsupported exception")
-      in
-      Mutex.lock rd_ths_mtx;
-      (match emsgs with
-      | Ok emsgs -> rd_ths_res := (fst !rd_ths_res, Some (Ok emsgs))
-      | Error emsg -> rd_ths_res := (fst !rd_ths_res, Some (Error emsg)));
-      Condition.broadcast rd_ths_cond;
-      Mutex.unlock rd_ths_mtx
+      emsgs :=
+        Some
+          (try Ok (Util.input_fully err_in_chn)
+           with _ -> Error (`ErrMsgReadingFailed "Unsupported exception"))
     in
-    let run_jobs _ =
-      let msg_rd_th = Thread.create msg_rd_job () in
-      let err_rd_th = Thread.create err_rd_job () in
-      Mutex.lock rd_ths_mtx;
-      while
-        match !rd_ths_res with
-        | Some (Error _), _ | _, Some (Error _) -> false
-        | Some (Ok _), Some (Ok _) -> false
-        | _ -> true
-      do
-        Condition.wait rd_ths_cond rd_ths_mtx
-      done;
-      let res =
-        match !rd_ths_res with
-        | Some (Ok msgs), Some (Ok emsgs) -> Ok (msgs, emsgs)
-        | Some (Error err), _ | _, Some (Error err) -> Error err
-        | _ -> failwith "Should not happen"
-      in
-      Mutex.unlock rd_ths_mtx;
-      res
+    let err_rd_th = Thread.create err_rd_job () in
+    let close_result = ref None in
+    let close_chns () =
+      match !close_result with
+        Some result -> result
+      | None ->
+        (* If we stopped reading early, this makes the exporter fail instead of block on its stdout. *)
+        close_in_noerr msg_in_chn;
+        Thread.join err_rd_th;
+        let result =
+          try
+            (*** TODO @Nima: Can we force to close channels in case of exception *)
+            match Unix.close_process_full (msg_in_chn, out_chn, err_in_chn), !emsgs with
+            | _, Some (Error err) -> Error err
+            | Unix.WEXITED 0, Some (Ok emsgs) ->
+              if List.mem "rust_exporter" Args.verbose_flags then print_endline emsgs;
+              Ok ()
+            | result, Some (Ok emsgs) ->
+                Error (`RustMirExpFailed (result, emsgs))
+            | result, None ->
+                Error (`RustMirExpFailed (result, "No error message could be read from std_err"))
+          with Unix.Unix_error (ecode, fname, param) ->
+            let emsg = SysUtil.gen_unix_error_msg ecode fname param in
+            Error (`SysCallFailed emsg)
+        in
+        close_result := Some result;
+        result
     in
-    let close_chns emsgs =
-      try
-        (*** TODO @Nima: Can we force to close channels in case of exception *)
-        match Unix.close_process_full (msg_in_chn, out_chn, err_in_chn) with
-        | Unix.WEXITED 0 ->
-          if List.mem "rust_exporter" Args.verbose_flags then print_endline emsgs;
-          Ok ()
-        | result ->
-            Error (`RustMirExpFailed (result, emsgs))
-      with Unix.Unix_error (ecode, fname, param) ->
-        let emsg = SysUtil.gen_unix_error_msg ecode fname param in
-        Error (`SysCallFailed emsg)
+    let read_message () =
+      try CpIO.ReadContext.read_message msg_rd_ctx with
+        CpIO.Unsupported_message_frame -> None
+    in
+    match CpIO.ReadContext.read_message msg_rd_ctx with
+    | Some msg -> Ok (msg, read_message, close_chns)
+    | None ->
+        let* _ = close_chns () in
+        Error (`RustMirDesFailed "No message from Rust MIR exporter")
+    | exception CpIO.Unsupported_message_frame ->
+        let* _ = close_chns () in
+        Error (`CapnpMsgReadingFailed "Unsupported message frame")
+    | exception _ ->
+        let* _ = close_chns () in
+        Error (`CapnpMsgReadingFailed "Unsupported exception")
+
+  let raise_frontend_error einfo =
+    let gen_emsg = "Rust frontend failed to generate VF MIR: " in
+    let desc =
+      match einfo with
+      | `CmdFailed (cmd, emsg) ->
+          "System Command [" ^ cmd ^ "] failed. Error:" ^ emsg
+      | `ProcessFailed bin ->
+          "Process for [" ^ bin ^ "] is been signaled or stopped"
+      | `RustMirDesFailed emsg ->
+          "Capnp message deserialization failed: " ^ emsg
+      | `RustMirExpFailed (result, emsg) ->
+          let failInfo =
+            match result with
+              Unix.WEXITED 1 -> (* Rustc aborted due to compilation errors *)
+              let emsg_lines = String.split_on_char '\n' emsg in
+              let diagnostics = List.filter (String.starts_with ~prefix:{|{"$message_type":"diagnostic"|}) emsg_lines in
+              let open Json in
+              let diagnostics = List.map parse_json diagnostics in
+              let fallback () =
+                let diagnostics_rendered = String.concat "" (List.map (fun d -> o_assoc "rendered" d |> s_value) diagnostics) in
+                raise (RustFrontend diagnostics_rendered)
+              in
+              let errors = List.filter (fun (O ps) -> (List.assoc "level" ps |> s_value) = "error") diagnostics in
+              begin match errors with
+                O ps::_ ->
+                let msg = List.assoc "message" ps |> s_value in
+                begin match List.assoc "spans" ps with
+                  A spans ->
+                    let is_primary_span ps = match List.assoc_opt "is_primary" ps with Some (B true) -> true | _ -> false in
+                    let primary_spans = List.filter (function O ps when is_primary_span ps -> true | _ -> false) spans in
+                    begin match primary_spans, spans with
+                    | O ps::_, _ | [], O ps::_ ->
+                      let path = List.assoc "file_name" ps |> s_value in
+                      let line_start = List.assoc "line_start" ps |> i_value in
+                      let line_end = List.assoc "line_end" ps |> i_value in
+                      let column_start = List.assoc "column_start" ps |> i_value in
+                      let column_end = List.assoc "column_end" ps |> i_value in
+                      let loc = Ast.Lexed ((path, line_start, column_start), (path, line_end, column_end)) in
+                      raise (Verifast0.RustcErrors (loc, msg, diagnostics))
+                    | _ -> fallback ()
+                    end
+                | _ -> fallback ()
+                end
+              | _ -> fallback ()
+              end
+            | Unix.WEXITED exitCode ->
+              let exitCodeInfo =
+                match exitCode with
+                  -1073741515 when Sys.os_type = "Win32" -> " (Missing DLL; define VERIFAST_DEBUG_MISSING_DLL to see dialog box with details)"
+                | _ -> ""
+              in
+              Printf.sprintf "exited with exit code %d%s" exitCode exitCodeInfo
+            | Unix.WSIGNALED signal -> Printf.sprintf "was killed with signal %d" signal
+            | Unix.WSTOPPED signal -> Printf.sprintf "was stopped with signal %d" signal
+          in
+          Printf.sprintf "Rust MIR exporter executable %s:\n%s" failInfo emsg
+      | `SysCallFailed emsg -> "System call failed: " ^ emsg
+      | `RustcDriverMissing tchain_name -> Printf.sprintf "To verify Rust programs, VeriFast requires the rustc-dev component of the %s Rust toolchain, but this component is currently not installed; please run 'rustup +%s component add rustc-dev' to install it." tchain_name tchain_name
     in
-    let* msgs =
-      match run_jobs () with
-      | Ok (msgs, emsgs) ->
-          let* _ = close_chns emsgs in
-          Ok msgs
-      | Error err ->
-          let* _ = close_chns "No error message could be read from std_err" in
-          Error err
+    raise (RustFrontend (gen_emsg ^ desc))
+
+  (** Returns the VF MIR, a function that returns the next streamed body, a function that returns the
+      streamed ADT definitions that follow the bodies, and a function that is to be called when the caller
+      is done with the exporter. *)
+  let get_vf_mir_rd (rustc_args : string list) (rs_file_path : string) =
+    let rustc_args = "--vf-rust-mir-exporter:stream-bodies"::rustc_args in
+    let* msg, read_message, close =
+      if !Verifast0.persistent_rust_exporter then
+        get_vf_mir_msgs_from_server rustc_args rs_file_path
+      else
+        get_vf_mir_msgs rustc_args rs_file_path
     in
-    match msgs with
-    | [] -> Error (`RustMirDesFailed "No message from Rust MIR exporter")
-    (*** For now we are just using the first message *)
-    | msg :: _ -> (
-        try
-          let vf_mir_rd = VfMirRd.VfMir.of_message msg in
-          Ok vf_mir_rd
-        with Capnp.Message.Invalid_message emsg ->
-          Error
-            (`RustMirDesFailed
-              ("Cannot create VF MIR from the received message. " ^ emsg)))
+    match VfMirRd.VfMir.of_message msg with
+    | exception Capnp.Message.Invalid_message emsg ->
+        let* _ = close () in
+        Error
+          (`RustMirDesFailed
+            ("Cannot create VF MIR from the received message. " ^ emsg))
+    | vf_mir_rd ->
+      let nb_streamed_bodies = VfMirRd.VfMir.streamed_bodies_get_int_exn vf_mir_rd in
+      (* The streamed bodies are followed by a message with the ADT definitions they require *)
+      let remaining_messages = ref (if nb_streamed_bodies = 0 then 0 else nb_streamed_bodies + 1) in
+      let finish_result = ref None in
+      let finish () =
+        match !finish_result with
+          Some result -> result
+        | None ->
+          (* Skip the messages that were not read, so that a persistent exporter is ready for the next request *)
+          while !remaining_messages > 0 && read_message () <> None do decr remaining_messages done;
+          remaining_messages := 0;
+          let result = close () in
+          finish_result := Some result;
+          result
+      in
+      let read_streamed_message () =
+        decr remaining_messages;
+        match read_message () with
+          Some msg -> msg
+        | None ->
+          remaining_messages := 0;
+          match finish () with
+            Error einfo -> raise_frontend_error einfo
+          | Ok () -> raise_frontend_error (`RustMirDesFailed "The Rust MIR exporter's output ended prematurely")
+      in
+      let read_streamed_body () = VfMirRd.Body.of_message (read_streamed_message ()) in
+      let read_streamed_adt_defs () = VfMirRd.StreamedAdtDefs.of_message (read_streamed_message ()) in
+      Ok (vf_mir_rd, read_streamed_body, read_streamed_adt_defs, finish)
 
   let parse_rs_file (rustc_args : string list) (extern_specs : string list) (rs_file_path : string) =
     Perf.init_windows_error_mode ();
     match get_vf_mir_rd rustc_args rs_file_path with
-    | Ok vf_mir_rd ->
+    | Ok (vf_mir_rd, read_streamed_body, read_streamed_adt_defs, finish) ->
+      Fun.protect ~finally:(fun () -> ignore (finish ())) @@ fun () ->
       let targetTriple = VfMirRd.VfMir.target_triple_get vf_mir_rd in
       let pointerWidth = VfMirRd.VfMir.pointer_width_get vf_mir_rd in
       let Some data_model = Args.data_model_opt in
@@ -233,65 +465,10 @@ module Make (Args : RUST_FE_ARGS) = struct
       if pointerWidth <> 8 * (1 lsl data_model.ptr_width) then
         raise (Parser.CompilationError (Printf.sprintf "C target %s does not match rustc target %s; specify a matching C target using the -target command-line option" data_model_name targetTriple));
       (!Stats.stats)#set_success_qualifier (Printf.sprintf "target: %s (%s)" targetTriple data_model_name);
-      VfMirTr.translate_vf_mir extern_specs vf_mir_rd
-    | Error einfo ->
-        let gen_emsg = "Rust frontend failed to generate VF MIR: " in
-        let desc =
-          match einfo with
-          | `CmdFailed (cmd, emsg) ->
-              "System Command [" ^ cmd ^ "] failed. Error:" ^ emsg
-          | `ProcessFailed bin ->
-              "Process for [" ^ bin ^ "] is been signaled or stopped"
-          | `RustMirDesFailed emsg ->
-              "Capnp message deserialization failed: " ^ emsg
-          | `RustMirExpFailed (result, emsg) ->
-              let failInfo =
-                match result with
-                  Unix.WEXITED 1 -> (* Rustc aborted due to compilation errors *)
-                  let emsg_lines = String.split_on_char '\n' emsg in
-                  let diagnostics = List.filter (String.starts_with ~prefix:{|{"$message_type":"diagnostic"|}) emsg_lines in
-                  let open Json in
-                  let diagnostics = List.map parse_json diagnostics in
-                  let fallback () =
-                    let diagnostics_rendered = String.concat "" (List.map (fun d -> o_assoc "rendered" d |> s_value) diagnostics) in
-                    raise (RustFrontend diagnostics_rendered)
-                  in
-                  let errors = List.filter (fun (O ps) -> (List.assoc "level" ps |> s_value) = "error") diagnostics in
-                  begin match errors with
-                    O ps::_ ->
-                    let msg = List.assoc "message" ps |> s_value in
-                    begin match List.assoc "spans" ps with
-                      A spans ->
-                        let is_primary_span ps = match List.assoc_opt "is_primary" ps with Some (B true) -> true | _ -> false in
-                        let primary_spans = List.filter (function O ps when is_primary_span ps -> true | _ -> false) spans in
-                        begin match primary_spans, spans with
-                        | O ps::_, _ | [], O ps::_ ->
-                          let path = List.assoc "file_name" ps |> s_value in
-                          let line_start = List.assoc "line_start" ps |> i_value in
-                          let line_end = List.assoc "line_end" ps |> i_value in
-                          let column_start = List.assoc "column_start" ps |> i_value in
-                          let column_end = List.assoc "column_end" ps |> i_value in
-                          let loc = Ast.Lexed ((path, line_start, column_start), (path, line_end, column_end)) in
-                          raise (Verifast0.RustcErrors (loc, msg, diagnostics))
-                        | _ -> fallback ()
-                        end
-                    | _ -> fallback ()
-                    end
-                  | _ -> fallback ()
-                  end
-                | Unix.WEXITED exitCode ->
-                  let exitCodeInfo =
-                    match exitCode with
-                      -1073741515 when Sys.os_type = "Win32" -> " (Missing DLL; define VERIFAST_DEBUG_MISSING_DLL to see dialog box with details)"
-                    | _ -> ""
-                  in
-                  Printf.sprintf "exited with exit code %d%s" exitCode exitCodeInfo
-                | Unix.WSIGNALED signal -> Printf.sprintf "was killed with signal %d" signal
-                | Unix.WSTOPPED signal -> Printf.sprintf "was stopped with signal %d" signal
-              in
-              Printf.sprintf "Rust MIR exporter executable %s:\n%s" failInfo emsg
-          | `SysCallFailed emsg -> "System call failed: " ^ emsg
-          | `RustcDriverMissing tchain_name -> Printf.sprintf "To verify Rust programs, VeriFast requires the rustc-dev component of the %s Rust toolchain, but this component is currently not installed; please run 'rustup +%s component add rustc-dev' to install it." tchain_name tchain_name
-        in
-        raise (RustFrontend (gen_emsg ^ desc))
+      let result = VfMirTr.translate_vf_mir extern_specs vf_mir_rd read_streamed_body read_streamed_adt_defs in
+      begin match finish () with
+        Ok () -> result
+      | Error einfo -> raise_frontend_error einfo
+      end
+    | Error einfo -> raise_frontend_error einfo
 end
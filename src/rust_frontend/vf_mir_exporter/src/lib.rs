@@ -63,15 +63,64 @@ enum PreprocessMode {
     Preprocess
 }
 
+/// In server mode, the VF MIR message produced by the current request is written to this buffer instead of stdout.
+static SERVER_MESSAGE: std::sync::Mutex<Option<Vec<u8>>> = std::sync::Mutex::new(None);
+
 pub fn run_compiler() -> i32 {
+    run_compiler_with_args(std::env::args().collect())
+}
+
+/// Runs the exporter as a long-lived process that serves multiple requests, so that the rustc driver
+/// needs to be loaded only once. Each request is a line on stdin consisting of the working directory and
+/// the command-line arguments (starting with the program name), separated by tabs. For each request, the
+/// compiler's diagnostics are written to stderr, followed by a line `vf-rust-mir-exporter: exit <code>`;
+/// then, if the exit code is 0, the VF MIR message is written to stdout.
+pub fn run_server() -> i32 {
+    use std::io::{BufRead, Write};
+    let stdin = std::io::stdin();
+    for line in stdin.lock().lines() {
+        let Ok(line) = line else { return 1 };
+        let mut fields = line.split('\t');
+        let cwd = fields.next().unwrap_or_default();
+        let rustc_args: Vec<String> = fields.map(|arg| arg.to_owned()).collect();
+        *SERVER_MESSAGE.lock().unwrap_or_else(std::sync::PoisonError::into_inner) = Some(Vec::new());
+        let exit_code = match std::env::set_current_dir(cwd) {
+            Ok(()) => run_compiler_with_args(rustc_args),
+            Err(err) => {
+                eprintln!("Could not change to directory '{}': {}", cwd, err);
+                1
+            }
+        };
+        let message = SERVER_MESSAGE.lock().unwrap_or_else(std::sync::PoisonError::into_inner).take().unwrap_or_default();
+        eprintln!("vf-rust-mir-exporter: exit {}", exit_code);
+        if exit_code == 0 {
+            let mut stdout = std::io::stdout().lock();
+            if stdout.write_all(&message).and_then(|()| stdout.flush()).is_err() {
+                return 1;
+            }
+        }
+    }
+    0
+}
+
+fn run_compiler_with_args(mut rustc_args: Vec<String>) -> i32 {
     rustc_driver::catch_with_exit_code(move || {
-        let mut rustc_args: Vec<_> = std::env::args().collect();
         rustc_args.push("-Coverflow_checks=off".to_owned());
         // We must pass -Zpolonius so that the borrowck information is computed.
         //rustc_args.push("-Zpolonius".to_owned());
         // To have MIR dump annotated with lifetimes
         //rustc_args.push("-Zverbose_internals".to_owned());
         let mut preprocess_mode = PreprocessMode::Preprocess;
+        let mut stream_bodies = false;
+        let mut cache_dir = None;
+        if let Some(index) = rustc_args.iter().position(|arg| arg == "--vf-rust-mir-exporter:stream-bodies") {
+            stream_bodies = true;
+            rustc_args.remove(index);
+        }
+        if let Some(index) = rustc_args.iter().position(|arg| arg.starts_with("--vf-rust-mir-exporter:cache-dir=")) {
+            cache_dir = Some(std::path::PathBuf::from(&rustc_args[index]["--vf-rust-mir-exporter:cache-dir=".len()..]));
+            rustc_args.remove(index);
+        }
         if let Some(index) = rustc_args.iter().position(|arg| arg == "--vf-rust-mir-exporter:preprocess-readonly") {
             preprocess_mode = PreprocessMode::PreprocessReadOnly;
             rustc_args.remove(index);
@@ -99,8 +148,10 @@ pub fn run_compiler() -> i32 {
         // See filesearch::get_or_default_sysroot()
 
         let mut callbacks = CompilerCalls {
-            source_files: Box::leak(Box::new(std::sync::Mutex::new(SourceFiles::new()))),
+            source_files: std::sync::Arc::new(std::sync::Mutex::new(SourceFiles::new())),
             preprocess_mode,
+            stream_bodies,
+            cache_dir,
         };
         // Call the Rust compiler with our callbacks.
         trace!("Calling the Rust Compiler with args: {:?}", rustc_args);
@@ -108,10 +159,205 @@ pub fn run_compiler() -> i32 {
     })
 }
 
+/// The result of preprocessing a source file. The ghost ranges are stored contiguously; they are boxed
+/// only when they are handed to the VF MIR builder.
+struct PreprocessedFile {
+    /// The digest of the file's original contents; see `contents_digest`
+    contents_digest: u128,
+    contents_len: usize,
+    read_only: bool,
+    preprocessed_contents: String,
+    directives: Vec<preprocessor::GhostRange>,
+    ghost_ranges: Vec<preprocessor::GhostRange>,
+}
+
+/// Maps the path of each source file preprocessed by this process to the result of its last preprocessing.
+/// When running as a server (see `run_server`), this avoids rescanning the files that did not change since
+/// the previous request, and rereading their results from the on-disk cache (see `preprocess_file`).
+/// It is not used otherwise, since each file is then preprocessed only once.
+static PREPROCESSED_FILES: std::sync::LazyLock<
+    std::sync::Mutex<HashMap<std::path::PathBuf, std::sync::Arc<PreprocessedFile>>>,
+> = std::sync::LazyLock::new(|| std::sync::Mutex::new(HashMap::new()));
+
+fn in_server_mode() -> bool {
+    SERVER_MESSAGE.lock().unwrap_or_else(std::sync::PoisonError::into_inner).is_some()
+}
+
+/// Returns the 128-bit FNV-1a hash of `bytes`. Unlike `DefaultHasher`, it is the same in every process
+/// and for every Rust version, so it can be used to name files in the on-disk cache.
+fn fnv1a_128(bytes: &[u8]) -> u128 {
+    const OFFSET_BASIS: u128 = 0x6c62272e07bb014262b821756295c58d;
+    const PRIME: u128 = 0x0000000001000000000000000000013b;
+    bytes.iter().fold(OFFSET_BASIS, |hash, &byte| (hash ^ byte as u128).wrapping_mul(PRIME))
+}
+
+fn contents_digest(contents: &str) -> u128 {
+    fnv1a_128(contents.as_bytes())
+}
+
+const PREPROCESSING_CACHE_FORMAT: &[u8] = b"VeriFast-rust-preprocessing-cache 1\n";
+
+/// Identifies this build of the exporter, so that results cached by a build with a different preprocessor
+/// are not reused.
+static EXPORTER_BUILD_STAMP: std::sync::LazyLock<String> = std::sync::LazyLock::new(|| {
+    let modified = std::env::current_exe()
+        .and_then(std::fs::metadata)
+        .and_then(|metadata| metadata.modified())
+        .ok()
+        .and_then(|modified| modified.duration_since(std::time::UNIX_EPOCH).ok());
+    match modified {
+        Some(modified) => format!("{}.{:09}", modified.as_secs(), modified.subsec_nanos()),
+        None => String::new(),
+    }
+});
+
+/// Returns the path of the file in `cache_dir` that holds the result of preprocessing a file whose contents
+/// have digest `contents_digest`.
+fn preprocessing_cache_path(
+    cache_dir: &std::path::Path,
+    contents_digest: u128,
+    read_only: bool,
+) -> std::path::PathBuf {
+    let mut key = Vec::new();
+    key.extend_from_slice(PREPROCESSING_CACHE_FORMAT);
+    key.extend_from_slice(EXPORTER_BUILD_STAMP.as_bytes());
+    key.push(read_only as u8);
+    key.extend_from_slice(&contents_digest.to_le_bytes());
+    cache_dir.join(format!("rust-preprocessed-{:032x}.vfpp", fnv1a_128(&key)))
+}
+
+fn read_cached_preprocessed_file(
+    cache_path: &std::path::Path,
+    contents_digest: u128,
+    contents_len: usize,
+    read_only: bool,
+) -> Option<PreprocessedFile> {
+    use preprocessor::GhostRange;
+    let data = std::fs::read(cache_path).ok()?;
+    let mut input = data.strip_prefix(PREPROCESSING_CACHE_FORMAT)?;
+    let (digest_bytes, rest) = input.split_first_chunk::<16>()?;
+    let (len_bytes, rest) = rest.split_first_chunk::<8>()?;
+    input = rest;
+    if u128::from_le_bytes(*digest_bytes) != contents_digest
+        || u64::from_le_bytes(*len_bytes) != contents_len as u64
+    {
+        return None;
+    }
+    let preprocessed_contents = preprocessor::read_string(&mut input)?;
+    fn read_ghost_ranges(input: &mut &[u8]) -> Option<Vec<GhostRange>> {
+        let (count_bytes, rest) = input.split_first_chunk::<8>()?;
+        *input = rest;
+        (0..u64::from_le_bytes(*count_bytes))
+            .map(|_| GhostRange::read_from(input))
+            .collect()
+    }
+    let directives = read_ghost_ranges(&mut input)?;
+    let ghost_ranges = read_ghost_ranges(&mut input)?;
+    Some(PreprocessedFile {
+        contents_digest,
+        contents_len,
+        read_only,
+        preprocessed_contents,
+        directives,
+        ghost_ranges,
+    })
+}
+
+/// Writes `preprocessed_file` to `cache_path` atomically. Failures are ignored.
+fn write_cached_preprocessed_file(cache_path: &std::path::Path, preprocessed_file: &PreprocessedFile) {
+    let mut data = Vec::new();
+    data.extend_from_slice(PREPROCESSING_CACHE_FORMAT);
+    data.extend_from_slice(&preprocessed_file.contents_digest.to_le_bytes());
+    data.extend_from_slice(&(preprocessed_file.contents_len as u64).to_le_bytes());
+    preprocessor::write_str(&mut data, &preprocessed_file.preprocessed_contents);
+    for ghost_ranges in [&preprocessed_file.directives, &preprocessed_file.ghost_ranges] {
+        data.extend_from_slice(&(ghost_ranges.len() as u64).to_le_bytes());
+        for ghost_range in ghost_ranges {
+            ghost_range.write_to(&mut data);
+        }
+    }
+    let Some(cache_dir) = cache_path.parent() else { return };
+    static TEMP_FILE_COUNTER: std::sync::atomic::AtomicUsize = std::sync::atomic::AtomicUsize::new(0);
+    let temp_file_index = TEMP_FILE_COUNTER.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+    let temp_path = cache_dir.join(format!("vfcache-{}-{}.tmp", std::process::id(), temp_file_index));
+    let result = std::fs::create_dir_all(cache_dir)
+        .and_then(|()| std::fs::write(&temp_path, &data))
+        .and_then(|()| std::fs::rename(&temp_path, cache_path));
+    if let Err(err) = result {
+        trace!("Could not write {:?}: {}", cache_path, err);
+        let _ = std::fs::remove_file(&temp_path);
+    }
+}
+
+/// Preprocesses `contents`, the contents of the file at `path`. If `cache_dir` is given, the result is looked up
+/// in, or else stored in, a file in `cache_dir` named after the digest of `contents`, so that unchanged files
+/// are not rescanned by later runs.
+fn preprocess_file(
+    path: &std::path::Path,
+    contents: String,
+    read_only: bool,
+    cache_dir: Option<&std::path::Path>,
+) -> std::sync::Arc<PreprocessedFile> {
+    let use_memory_cache = in_server_mode();
+    let contents_digest = contents_digest(&contents);
+    if use_memory_cache {
+        if let Some(preprocessed_file) = PREPROCESSED_FILES
+            .lock()
+            .unwrap_or_else(std::sync::PoisonError::into_inner)
+            .get(path)
+        {
+            if preprocessed_file.read_only == read_only
+                && preprocessed_file.contents_len == contents.len()
+                && preprocessed_file.contents_digest == contents_digest
+            {
+                trace!("Reusing the preprocessing result for {:?}", path);
+                return preprocessed_file.clone();
+            }
+        }
+    }
+    let cache_path = cache_dir.map(|cache_dir| preprocessing_cache_path(cache_dir, contents_digest, read_only));
+    let cached_preprocessed_file = cache_path.as_deref().and_then(|cache_path| {
+        read_cached_preprocessed_file(cache_path, contents_digest, contents.len(), read_only)
+    });
+    let preprocessed_file = match cached_preprocessed_file {
+        Some(preprocessed_file) => {
+            trace!("Read the preprocessing result for {:?} from {:?}", path, cache_path);
+            std::sync::Arc::new(preprocessed_file)
+        }
+        None => {
+            let mut directives = Vec::new();
+            let mut ghost_ranges = Vec::new();
+            let preprocessed_contents =
+                preprocessor::preprocess(contents.as_str(), read_only, &mut directives, &mut ghost_ranges);
+            if read_only {
+                assert_eq!(preprocessed_contents, contents);
+            }
+            let preprocessed_file = std::sync::Arc::new(PreprocessedFile {
+                contents_digest,
+                contents_len: contents.len(),
+                read_only,
+                preprocessed_contents,
+                directives,
+                ghost_ranges,
+            });
+            if let Some(cache_path) = &cache_path {
+                write_cached_preprocessed_file(cache_path, &preprocessed_file);
+            }
+            preprocessed_file
+        }
+    };
+    if use_memory_cache {
+        PREPROCESSED_FILES
+            .lock()
+            .unwrap_or_else(std::sync::PoisonError::into_inner)
+            .insert(path.into(), preprocessed_file.clone());
+    }
+    preprocessed_file
+}
+
 struct SourceFile {
     path: Box<std::path::Path>,
-    directives: Vec<Box<preprocessor::GhostRange>>,
-    ghost_ranges: Vec<Box<preprocessor::GhostRange>>,
+    preprocessed_file: std::sync::Arc<PreprocessedFile>,
 }
 
 struct SourceFiles {
@@ -136,17 +382,27 @@ impl SourceFiles {
         sm: &rustc_span::source_map::SourceMap,
     ) {
         let mut source_files = core::mem::replace(&mut self.source_files, Vec::new());
-        for mut source_file in source_files.drain(..) {
+        for source_file in source_files.drain(..) {
             let filename = rustc_span::FileName::Real(rustc_span::RealFileName::LocalPath(
                 std::path::PathBuf::from(source_file.path),
             ));
             let rustc_source_file = sm.get_source_file(&filename).unwrap();
             let start_pos = rustc_source_file.start_pos;
-            for mut directive in source_file.directives.drain(..) {
+            let (directives, ghost_ranges) = match std::sync::Arc::try_unwrap(source_file.preprocessed_file) {
+                // Not shared with `PREPROCESSED_FILES`, so the ghost ranges can be moved rather than copied.
+                Ok(preprocessed_file) => (preprocessed_file.directives, preprocessed_file.ghost_ranges),
+                Err(preprocessed_file) => (
+                    preprocessed_file.directives.clone(),
+                    preprocessed_file.ghost_ranges.clone(),
+                ),
+            };
+            for directive in directives {
+                let mut directive = Box::new(directive);
                 directive.set_span(start_pos);
                 all_directives.push(directive);
             }
-            for mut ghost_range in source_file.ghost_ranges.drain(..) {
+            for ghost_range in ghost_ranges {
+                let mut ghost_range = Box::new(ghost_range);
                 ghost_range.set_span(start_pos);
                 all_ghost_ranges.push(ghost_range);
             }
@@ -156,7 +412,9 @@ impl SourceFiles {
 
 struct FileLoader {
     read_only: bool,
-    source_files: &'static std::sync::Mutex<SourceFiles>,
+    /// The directory of the on-disk preprocessing cache, if any; see `preprocess_file`
+    cache_dir: Option<std::path::PathBuf>,
+    source_files: std::sync::Arc<std::sync::Mutex<SourceFiles>>,
 }
 
 impl rustc_span::source_map::FileLoader for FileLoader {
@@ -172,17 +430,11 @@ impl rustc_span::source_map::FileLoader for FileLoader {
         if path.to_string_lossy().contains("toolchains") {
             Ok(contents)
         } else {
-            let mut directives = Vec::new();
-            let mut ghost_ranges = Vec::new();
-            let preprocessed_contents =
-                preprocessor::preprocess(contents.as_str(), self.read_only, &mut directives, &mut ghost_ranges);
-            if self.read_only {
-                assert_eq!(preprocessed_contents, contents);
-            }
+            let preprocessed_file = preprocess_file(path, contents, self.read_only, self.cache_dir.as_deref());
+            let preprocessed_contents = preprocessed_file.preprocessed_contents.clone();
             self.source_files.lock().unwrap().push(SourceFile {
                 path: path.into(),
-                directives,
-                ghost_ranges,
+                preprocessed_file,
             });
             Ok(preprocessed_contents)
         }
@@ -196,8 +448,14 @@ impl rustc_span::source_map::FileLoader for FileLoader {
 }
 
 struct CompilerCalls {
-    source_files: &'static std::sync::Mutex<SourceFiles>,
+    /// Owned by the request rather than leaked, since a server (see `run_server`) runs many requests.
+    source_files: std::sync::Arc<std::sync::Mutex<SourceFiles>>,
     preprocess_mode: PreprocessMode,
+    /// Emit each function body as a separate message after the VF MIR message, so that the consumer can
+    /// translate the bodies as they arrive. The VF MIR message's `streamedBodies` field gives their number.
+    stream_bodies: bool,
+    /// Given by the --vf-rust-mir-exporter:cache-dir=DIR option
+    cache_dir: Option<std::path::PathBuf>,
 }
 
 impl rustc_driver::Callbacks for CompilerCalls {
@@ -210,7 +468,8 @@ impl rustc_driver::Callbacks for CompilerCalls {
         if self.preprocess_mode != PreprocessMode::DoNotPreprocess {
             config.file_loader = Some(Box::from(FileLoader {
                 read_only: self.preprocess_mode == PreprocessMode::PreprocessReadOnly,
-                source_files: self.source_files,
+                cache_dir: self.cache_dir.clone(),
+                source_files: self.source_files.clone(),
             }));
         }
 
@@ -269,6 +528,7 @@ impl rustc_driver::Callbacks for CompilerCalls {
         //     .collect();
 
         let mut vf_mir_capnp_builder = vf_mir_builder::VfMirCapnpBuilder::new(tcx);
+        vf_mir_capnp_builder.set_stream_bodies(self.stream_bodies);
         let mut directives = Vec::new();
         let mut ghost_ranges = Vec::new();
         self.source_files.lock().unwrap().export_data(
@@ -287,9 +547,11 @@ impl rustc_driver::Callbacks for CompilerCalls {
         vf_mir_capnp_builder.set_ty_aliases(visitor.ty_aliases);
         vf_mir_capnp_builder.set_trait_impls(visitor.trait_impls);
         vf_mir_capnp_builder.add_bodies(bodies);
-        let msg_cpn = vf_mir_capnp_builder.build(compiler);
-        capnp::serialize::write_message(&mut ::std::io::stdout(), msg_cpn.borrow_inner())
-            .unwrap();
+        match &mut *SERVER_MESSAGE.lock().unwrap_or_else(std::sync::PoisonError::into_inner) {
+            Some(buffer) => vf_mir_capnp_builder.build(compiler, buffer),
+            None => vf_mir_capnp_builder.build(compiler, &mut ::std::io::stdout().lock()),
+        }
+        .unwrap();
         Compilation::Stop
     }
 }
@@ -540,6 +802,8 @@ mod vf_mir_builder {
     use terminator_kind_cpn::switch_int_data as switch_int_data_cpn;
     use tracing::{debug, trace};
     use crate::vf_mir_capnp::adt_def as adt_def_cpn;
+    use crate::vf_mir_capnp::ind_list as ind_list_cpn;
+    use crate::vf_mir_capnp::streamed_adt_defs as streamed_adt_defs_cpn;
     use crate::vf_mir_capnp::adt_def_id as adt_def_id_cpn;
     use crate::vf_mir_capnp::adt_kind as adt_kind_cpn;
     use ty_kind_cpn::adt_ty as adt_ty_cpn;
@@ -673,6 +937,11 @@ mod vf_mir_builder {
         trait_impls: Vec<super::TraitImplInfo>,
         bodies: Vec<(mir::Body<'tcx>, Span)>,
         annots: LinkedList<Box<GhostRange>>,
+        stream_bodies: bool,
+        /// If bodies are streamed, the annotations inside each of `bodies`, in the same order.
+        body_annots: Vec<LinkedList<Box<GhostRange>>>,
+        /// The ADT definitions written so far.
+        encoded_adt_defs: Vec<ty::AdtDef<'tcx>>,
     }
 
     impl<'tcx: 'a, 'a> VfMirCapnpBuilder<'tcx> {
@@ -685,9 +954,16 @@ mod vf_mir_builder {
                 trait_impls: Vec::new(),
                 bodies: Vec::new(),
                 annots: LinkedList::new(),
+                stream_bodies: false,
+                body_annots: Vec::new(),
+                encoded_adt_defs: Vec::new(),
             }
         }
 
+        pub fn set_stream_bodies(&mut self, stream_bodies: bool) {
+            self.stream_bodies = stream_bodies;
+        }
+
         pub(super) fn set_directives(&mut self, directives: Vec<Box<GhostRange>>) {
             self.directives = directives;
         }
@@ -716,17 +992,37 @@ mod vf_mir_builder {
             self.bodies = bodies;
         }
 
-        pub fn build(
-            mut self,
-            compiler: &Compiler,
-        ) -> ::capnp::message::TypedBuilder<vf_mir_cpn::Owned> {
+        /// Writes the VF MIR message to `out`, followed, if bodies are streamed, by one message per body and
+        /// a message with the ADT definitions required by the bodies that are not in the VF MIR message.
+        /// Each body is encoded once and written right away, so only one body message is held in memory at a time.
+        pub fn build<W: std::io::Write>(mut self, compiler: &Compiler, out: &mut W) -> ::capnp::Result<()> {
             let mut msg_cpn = ::capnp::message::TypedBuilder::<vf_mir_cpn::Owned>::new_default();
             let mut vf_mir_cpn = msg_cpn.init_root();
             vf_mir_cpn.set_target_triple(&compiler.sess.target.llvm_target);
             vf_mir_cpn.set_pointer_width(compiler.sess.target.pointer_width.try_into().unwrap());
             self.encode_trait_impls(&mut vf_mir_cpn);
             self.encode_mir(vf_mir_cpn);
-            msg_cpn
+            capnp::serialize::write_message(&mut *out, msg_cpn.borrow_inner())?;
+            drop(msg_cpn);
+            if self.stream_bodies {
+                let body_annots = std::mem::take(&mut self.body_annots);
+                let mut req_adt_defs = Vec::new();
+                for ((body, span), annots) in self.bodies.iter().zip(body_annots) {
+                    let mut body_msg_cpn = ::capnp::message::TypedBuilder::<body_cpn::Owned>::new_default();
+                    Self::encode_body_with_annots(self.tcx, annots, &mut req_adt_defs, body, span, body_msg_cpn.init_root());
+                    capnp::serialize::write_message(&mut *out, body_msg_cpn.borrow_inner())?;
+                }
+                let mut adt_defs_msg_cpn = ::capnp::message::TypedBuilder::<streamed_adt_defs_cpn::Owned>::new_default();
+                Self::encode_req_adt_defs(
+                    self.tcx,
+                    req_adt_defs,
+                    &mut self.encoded_adt_defs,
+                    adt_defs_msg_cpn.init_root().init_adt_defs(),
+                );
+                capnp::serialize::write_message(&mut *out, adt_defs_msg_cpn.borrow_inner())?;
+            }
+            out.flush()?;
+            Ok(())
         }
 
         fn encode_trait_impls(&mut self, vf_mir_cpn: &mut vf_mir_cpn::Builder<'_>) {
@@ -928,34 +1224,20 @@ mod vf_mir_builder {
             // Encode traits (consumes annotations)
             self.encode_traits(&mut req_adt_defs, vf_mir_cpn.reborrow());
 
-            vf_mir_cpn.fill_bodies(&self.bodies, |mut body_cpn, (body, span)| {
-                Self::encode_span_data(
-                    self.tcx,
-                    &span.data(),
-                    body_cpn.reborrow().init_fn_sig_span(),
-                );
-                let body_span = body.span.data();
-                let mut annots = self
-                    .annots
-                    .extract_if(|annot| {
-                        body_span.contains(
-                            annot
-                                .span()
-                                .expect("Dummy annot found during serialization")
-                                .data(),
-                        )
-                    })
-                    .collect::<LinkedList<_>>();
-                let mut_annots = annots.extract_if(|annot| {
-                    annot.kind == GhostRangeKind::Mut
-                }).map(|annot| {
-                    trace!("Found mut annotation: {:?}", annot);
-                    annot.span().unwrap().data().hi
-                }).collect::<Vec<_>>();
-                let mut enc_ctx = EncCtx::new(self.tcx, EncKind::Body(body), annots, mut_annots);
-                Self::encode_body(&mut enc_ctx, body_cpn);
-                req_adt_defs.extend(enc_ctx.get_req_adts());
-            });
+            if self.stream_bodies {
+                // The bodies are encoded and written after this message by `build`, together with the ADT
+                // definitions they require. Translating a body requires only the ADT definitions of the
+                // self types of trait impls, which are structs and therefore in this message.
+                for (body, _) in &self.bodies {
+                    self.body_annots.push(Self::extract_body_annots(&mut self.annots, body));
+                }
+                vf_mir_cpn.set_streamed_bodies(self.bodies.len().try_into().unwrap());
+            } else {
+                vf_mir_cpn.fill_bodies(&self.bodies, |body_cpn, (body, span)| {
+                    let annots = Self::extract_body_annots(&mut self.annots, body);
+                    Self::encode_body_with_annots(self.tcx, annots, &mut req_adt_defs, body, span, body_cpn);
+                });
+            }
 
             // Encode directives
             vf_mir_cpn.fill_directives(&self.directives, |directive_cpn, directive| {
@@ -997,8 +1279,22 @@ mod vf_mir_builder {
             });
 
             // Encode Required Definitions
-            let mut adt_defs_cpn = vf_mir_cpn.init_adt_defs();
-            let mut encoded_adt_defs = Vec::new();
+            Self::encode_req_adt_defs(
+                self.tcx,
+                req_adt_defs,
+                &mut self.encoded_adt_defs,
+                vf_mir_cpn.init_adt_defs(),
+            );
+        }
+
+        /// Encodes the local ADT definitions in `req_adt_defs` and the ones they require in turn,
+        /// skipping those in `encoded_adt_defs`, and adds them to `encoded_adt_defs`.
+        fn encode_req_adt_defs(
+            tcx: TyCtxt<'tcx>,
+            mut req_adt_defs: Vec<ty::AdtDef<'tcx>>,
+            encoded_adt_defs: &mut Vec<ty::AdtDef<'tcx>>,
+            mut adt_defs_cpn: ind_list_cpn::Builder<'_, adt_def_cpn::Owned>,
+        ) {
             while !req_adt_defs.is_empty() {
                 let it = req_adt_defs.into_iter();
                 req_adt_defs = Vec::new();
@@ -1017,8 +1313,8 @@ mod vf_mir_builder {
                             let mut adt_defs_cons_cpn = adt_defs_cpn.init_cons();
                             let adt_def_cpn = adt_defs_cons_cpn.reborrow().init_h();
                             let mut enc_ctx =
-                                EncCtx::new(self.tcx, EncKind::Adt, LinkedList::new(), Vec::new());
-                            Self::encode_adt_def(self.tcx, &mut enc_ctx, &adt_def, adt_def_cpn);
+                                EncCtx::new(tcx, EncKind::Adt, LinkedList::new(), Vec::new());
+                            Self::encode_adt_def(tcx, &mut enc_ctx, &adt_def, adt_def_cpn);
                             req_adt_defs.extend(enc_ctx.get_req_adts());
                             encoded_adt_defs.push(adt_def);
                             adt_defs_cpn = adt_defs_cons_cpn.init_t();
@@ -1030,6 +1326,49 @@ mod vf_mir_builder {
             adt_defs_cpn.set_nil(());
         }
 
+        /// Removes the annotations inside `body` from `annots` and returns them.
+        fn extract_body_annots(
+            annots: &mut LinkedList<Box<GhostRange>>,
+            body: &mir::Body<'tcx>,
+        ) -> LinkedList<Box<GhostRange>> {
+            let body_span = body.span.data();
+            annots
+                .extract_if(|annot| {
+                    body_span.contains(
+                        annot
+                            .span()
+                            .expect("Dummy annot found during serialization")
+                            .data(),
+                    )
+                })
+                .collect::<LinkedList<_>>()
+        }
+
+        /// Encodes a body together with `annots`, the annotations inside it.
+        fn encode_body_with_annots(
+            tcx: TyCtxt<'tcx>,
+            mut annots: LinkedList<Box<GhostRange>>,
+            req_adt_defs: &mut Vec<ty::AdtDef<'tcx>>,
+            body: &'a mir::Body<'tcx>,
+            span: &Span,
+            mut body_cpn: body_cpn::Builder<'_>,
+        ) {
+            Self::encode_span_data(
+                tcx,
+                &span.data(),
+                body_cpn.reborrow().init_fn_sig_span(),
+            );
+            let mut_annots = annots.extract_if(|annot| {
+                annot.kind == GhostRangeKind::Mut
+            }).map(|annot| {
+                trace!("Found mut annotation: {:?}", annot);
+                annot.span().unwrap().data().hi
+            }).collect::<Vec<_>>();
+            let mut enc_ctx = EncCtx::new(tcx, EncKind::Body(body), annots, mut_annots);
+            Self::encode_body(&mut enc_ctx, body_cpn);
+            req_adt_defs.extend(enc_ctx.get_req_adts());
+        }
+
         fn encode_adt_def_id(
             enc_ctx: &mut EncCtx<'tcx, 'a>,
             adt_did: hir::def_id::DefId,
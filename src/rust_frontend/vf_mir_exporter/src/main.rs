@@ -17,7 +17,11 @@ fn main() {
     use vf_mir_exporter::*;
     init_tracing();
 
-    let exit_code = run_compiler();
+    let exit_code = if std::env::args().any(|arg| arg == "--vf-rust-mir-exporter:server") {
+        run_server()
+    } else {
+        run_compiler()
+    };
 
     std::process::exit(exit_code);
 }
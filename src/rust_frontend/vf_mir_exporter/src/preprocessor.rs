@@ -9,6 +9,41 @@ impl SrcPos {
     pub fn is_dummy(&self) -> bool {
         self.line == -1 || self.column == -1
     }
+    fn write_to(&self, out: &mut Vec<u8>) {
+        out.extend_from_slice(&self.line.to_le_bytes());
+        out.extend_from_slice(&self.column.to_le_bytes());
+        out.extend_from_slice(&self.byte_pos.to_le_bytes());
+    }
+    fn read_from(input: &mut &[u8]) -> Option<SrcPos> {
+        Some(SrcPos {
+            line: i32::from_le_bytes(read_array(input)?),
+            column: i32::from_le_bytes(read_array(input)?),
+            byte_pos: u32::from_le_bytes(read_array(input)?),
+        })
+    }
+}
+
+// Helpers for the binary encoding of ghost ranges used by the exporter's on-disk preprocessing cache.
+
+fn read_array<const N: usize>(input: &mut &[u8]) -> Option<[u8; N]> {
+    let (bytes, rest) = input.split_first_chunk::<N>()?;
+    *input = rest;
+    Some(*bytes)
+}
+
+pub fn write_str(out: &mut Vec<u8>, s: &str) {
+    out.extend_from_slice(&(s.len() as u64).to_le_bytes());
+    out.extend_from_slice(s.as_bytes());
+}
+
+pub fn read_string(input: &mut &[u8]) -> Option<String> {
+    let len: usize = u64::from_le_bytes(read_array(input)?).try_into().ok()?;
+    if input.len() < len {
+        return None;
+    }
+    let (bytes, rest) = input.split_at(len);
+    *input = rest;
+    String::from_utf8(bytes.to_vec()).ok()
 }
 
 struct TextIterator<'a> {
@@ -67,7 +102,19 @@ pub enum GhostRangeKind {
     Mut,
 }
 
-#[derive(Debug)]
+impl GhostRangeKind {
+    fn from_u8(tag: u8) -> Option<GhostRangeKind> {
+        match tag {
+            0 => Some(GhostRangeKind::Regular),
+            1 => Some(GhostRangeKind::BlockDecls),
+            2 => Some(GhostRangeKind::GenericArgs),
+            3 => Some(GhostRangeKind::Mut),
+            _ => None,
+        }
+    }
+}
+
+#[derive(Clone, Debug)]
 pub struct GhostRange {
     in_fn_body: bool,
     pub kind: GhostRangeKind,
@@ -120,6 +167,38 @@ impl GhostRange {
     pub fn end_pos(&self) -> SrcPos {
         self.end
     }
+    /// Appends the encoding of this ghost range, which must not have a span yet, to `out`.
+    pub fn write_to(&self, out: &mut Vec<u8>) {
+        assert!(self.span.is_none());
+        out.push(self.in_fn_body as u8);
+        out.push(self.kind as u8);
+        match &self.block_end {
+            None => out.push(0),
+            Some(block_end) => {
+                out.push(1);
+                block_end.write_to(out);
+            }
+        }
+        self.end_of_preceding_token.write_to(out);
+        self.start.write_to(out);
+        self.end.write_to(out);
+        write_str(out, &self.contents);
+    }
+    /// Decodes a ghost range written by `write_to` from the start of `input` and advances `input` past it.
+    pub fn read_from(input: &mut &[u8]) -> Option<GhostRange> {
+        let [in_fn_body, kind] = read_array(input)?;
+        let [has_block_end] = read_array(input)?;
+        Some(GhostRange {
+            in_fn_body: in_fn_body != 0,
+            kind: GhostRangeKind::from_u8(kind)?,
+            block_end: if has_block_end != 0 { Some(SrcPos::read_from(input)?) } else { None },
+            end_of_preceding_token: SrcPos::read_from(input)?,
+            start: SrcPos::read_from(input)?,
+            end: SrcPos::read_from(input)?,
+            contents: read_string(input)?,
+            span: None,
+        })
+    }
 }
 
 fn ghost_range_contents_is_block_decls(contents: &str) -> bool {
@@ -144,8 +223,8 @@ const VF_GHOST_CMD_TAG_LEN: u32 = VF_GHOST_CMD_TAG.len() as u32;
 pub fn preprocess(
     input: &str,
     read_only: bool,
-    directives: &mut Vec<Box<GhostRange>>,
-    ghost_ranges: &mut Vec<Box<GhostRange>>,
+    directives: &mut Vec<GhostRange>,
+    ghost_ranges: &mut Vec<GhostRange>,
 ) -> String {
     let input_starts_with_bom = input.starts_with("\u{feff}");
     let mut cs = TextIterator {
@@ -320,7 +399,7 @@ pub fn preprocess(
                                                     brace_depth: brace_depth,
                                                 });
                                         }
-                                        ghost_ranges.push(Box::new(GhostRange {
+                                        ghost_ranges.push(GhostRange {
                                             in_fn_body,
                                             end_of_preceding_token: start_of_whitespace,
                                             start,
@@ -333,7 +412,7 @@ pub fn preprocess(
                                                 GhostRangeKind::Regular
                                             },
                                             block_end: None,
-                                        }));
+                                        });
                                         ghost_range_seen_since_last_token = true;
                                     }
                                     Some('~') => {
@@ -361,7 +440,7 @@ pub fn preprocess(
                                                 }
                                             }
                                         }
-                                        directives.push(Box::new(GhostRange {
+                                        directives.push(GhostRange {
                                             in_fn_body,
                                             end_of_preceding_token: start_of_whitespace,
                                             start,
@@ -370,7 +449,7 @@ pub fn preprocess(
                                             span: None,
                                             kind: GhostRangeKind::Regular,
                                             block_end: None,
-                                        }));
+                                        });
                                         loop {
                                             match cs.peek() {
                                                 None => {
@@ -418,7 +497,7 @@ pub fn preprocess(
                                     start_of_whitespace.column -= 2;
                                     ghost_range_seen_since_last_token = false;
                                 }
-                                let mut ghost_range = Box::new(GhostRange {
+                                let mut ghost_range = GhostRange {
                                     in_fn_body: false,
                                     end_of_preceding_token: start_of_whitespace,
                                     start: SrcPos {
@@ -435,7 +514,7 @@ pub fn preprocess(
                                     span: None,
                                     kind: GhostRangeKind::Regular,
                                     block_end: None,
-                                });
+                                };
                                 let mut is_ghost_range = false;
                                 let is_ghost_cmd;
                                 let mut is_generic_args = false;
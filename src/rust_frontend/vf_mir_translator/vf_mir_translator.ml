@@ -343,8 +343,33 @@ module type VF_MIR_TRANSLATOR_ARGS = sig
   val ignore_unwind_paths : bool
 end
 
-module Make (Args : VF_MIR_TRANSLATOR_ARGS) = struct
+module Make (Args0 : VF_MIR_TRANSLATOR_ARGS) = struct
   open Ocaml_aux
+
+  (* Reports made while translating a body in a worker process (see translate_bodies_in_parallel) are
+     recorded, so that the parent process can replay them. *)
+  type report =
+    | ReportShouldFail of string * Ast.loc0
+    | ReportRange of Lexer.range_kind * Ast.loc0
+
+  let recorded_reports : report list ref option ref = ref None
+
+  let replay_report = function
+    | ReportShouldFail (s, l) -> Args0.report_should_fail s l
+    | ReportRange (kind, l) -> Args0.report_range kind l
+
+  module Args = struct
+    include Args0
+
+    let record report =
+      match !recorded_reports with
+      | None -> replay_report report
+      | Some reports -> reports := report :: !reports
+
+    let report_should_fail s l = record (ReportShouldFail (s, l))
+    let report_range kind l = record (ReportRange (kind, l))
+  end
+
   module VfMirAnnotParser = Vf_mir_annot_parser.Make (Args)
   module VfMirCapnpAlias = Vf_mir_capnp_alias
   module VfMirRd = VfMirCapnpAlias.VfMirRd
@@ -7455,8 +7480,229 @@ module Make (Args : VF_MIR_TRANSLATOR_ARGS) = struct
     | Ast.ManifestTypeExpr (_, Int (Signed, PtrRank)) -> {kind = Type {kind=Int ISize}}
     | te -> Ast.static_error (Ast.type_expr_loc te) "This type expression is not supported in function specializations" None
 
+  let translate_body_timed (body_tr_defs_ctx : body_tr_defs_ctx)
+      (body_cpn : BodyRd.t) =
+    let t0 = Unix.gettimeofday () in
+    let result = translate_body body_tr_defs_ctx body_cpn in
+    (result, Unix.gettimeofday () -. t0)
+
+  let body_translation_name body_cpn =
+    TrName.translate_def_path (BodyRd.def_path_get body_cpn)
+
+  let record_body_translation_timing body_cpn seconds =
+    (!Stats.stats)#recordBodyTranslationTiming (body_translation_name body_cpn) seconds
+
+  (** What a worker process of [translate_bodies_in_parallel] sends back for a body. *)
+  type ('body_tr_res, 'report) worker_outcome =
+    | Translated of 'body_tr_res * 'report list * string * float
+        (** The translation result, the reports made while translating, the body's name, and the time taken *)
+    | TranslationFailed  (** The translation returned an error. *)
+    | TranslationRaised of string  (** The translation raised the given exception. *)
+
+  type translation_worker = {
+    pid : int;
+    task_chn : out_channel;
+    result_fd : Unix.file_descr;
+    result_buf : Buffer.t;  (** The part of the next result message received so far *)
+    mutable in_flight : int option;  (** The index of the body the worker is translating *)
+    mutable alive : bool;
+  }
+
+  (** Translates the bodies in [bodies_cpn], followed by those of the [nb_streamed_bodies] bodies returned by
+      [read_streamed_body] that satisfy [is_body_to_translate], in [jobs] worker processes forked from this
+      process. Each body is sent to an idle worker as soon as it is read, so that only the bodies being
+      translated are held in memory in undecoded form. A worker sends back the outcome of each body as soon
+      as it is done with it, together with the parser counters it incremented, which are added to this
+      process's statistics. The results are combined in the order of the bodies. If a body's translation
+      failed or raised an exception, or its worker died, it is translated again in this process, to report
+      the error in the same way as a sequential translation would. *)
+  let translate_bodies_in_parallel jobs (body_tr_defs_ctx : body_tr_defs_ctx) is_body_to_translate
+      (bodies_cpn : BodyRd.t list) nb_streamed_bodies read_streamed_body =
+    let run_worker task_chn result_chn =
+      recorded_reports := Some (ref []);
+      let reports = Option.get !recorded_reports in
+      let rec iter () =
+        match (Marshal.from_channel task_chn : int * BodyRd.t) with
+        | exception End_of_file -> ()
+        | i, body_cpn ->
+            reports := [];
+            let stmts0, opens0, closes0 = (!Stats.stats)#parseCounters in
+            let outcome =
+              match translate_body_timed body_tr_defs_ctx body_cpn with
+              | Ok body_tr_res, seconds ->
+                  Translated (body_tr_res, List.rev !reports, body_translation_name body_cpn, seconds)
+              | Error _, _ -> TranslationFailed
+              | exception e -> TranslationRaised (Printexc.to_string e)
+            in
+            let stmts1, opens1, closes1 = (!Stats.stats)#parseCounters in
+            Marshal.to_channel result_chn
+              (i, outcome, (stmts1 - stmts0, opens1 - opens0, closes1 - closes0))
+              [ Marshal.Closures ];
+            flush result_chn;
+            iter ()
+      in
+      iter ();
+      close_out result_chn
+    in
+    flush stdout;
+    flush stderr;
+    (* A worker that died must not take this process down when it is sent a body. *)
+    let old_sigpipe_behavior = Sys.signal Sys.sigpipe Sys.Signal_ignore in
+    Fun.protect ~finally:(fun () -> Sys.set_signal Sys.sigpipe old_sigpipe_behavior) @@ fun () ->
+    let parent_fds = ref [] in
+    let workers =
+      List.init jobs @@ fun _ ->
+      let task_in_fd, task_out_fd = Unix.pipe ~cloexec:true () in
+      let result_in_fd, result_out_fd = Unix.pipe ~cloexec:true () in
+      match Unix.fork () with
+      | 0 ->
+          (* Close this process's ends of all workers' pipes, so that each worker sees the end of its task
+             pipe as soon as this process closes it. *)
+          List.iter Unix.close (task_out_fd :: result_in_fd :: !parent_fds);
+          (* Worker processes exit without running the at_exit handlers of the parent process. *)
+          (try
+             run_worker
+               (Unix.in_channel_of_descr task_in_fd)
+               (Unix.out_channel_of_descr result_out_fd)
+           with _ -> ());
+          Unix._exit 0
+      | pid ->
+          Unix.close task_in_fd;
+          Unix.close result_out_fd;
+          parent_fds := task_out_fd :: result_in_fd :: !parent_fds;
+          {
+            pid;
+            task_chn = Unix.out_channel_of_descr task_out_fd;
+            result_fd = result_in_fd;
+            result_buf = Buffer.create 65536;
+            in_flight = None;
+            alive = true;
+          }
+    in
+    let nb_bodies = ref 0 in
+    let outcomes = Hashtbl.create 100 in
+    (* The bodies that are being translated by a worker or that are to be translated again in this process *)
+    let retained_bodies = Hashtbl.create 100 in
+    let worker_died w =
+      (* Its body, if any, stays in [retained_bodies] without an outcome and is translated in this process. *)
+      w.alive <- false;
+      w.in_flight <- None;
+      close_out_noerr w.task_chn
+    in
+    let chunk = Bytes.create 65536 in
+    let receive w =
+      match Unix.read w.result_fd chunk 0 (Bytes.length chunk) with
+      | exception Unix.Unix_error _ -> worker_died w
+      | 0 -> worker_died w
+      | n ->
+          Buffer.add_subbytes w.result_buf chunk 0 n;
+          let len = Buffer.length w.result_buf in
+          if
+            len >= Marshal.header_size
+            && len
+               >= Marshal.total_size
+                    (Bytes.unsafe_of_string (Buffer.sub w.result_buf 0 Marshal.header_size))
+                    0
+          then begin
+            (* A worker is sent a body only when it is idle, so this is its only pending message. *)
+            let i, outcome, parse_counters =
+              (Marshal.from_string (Buffer.contents w.result_buf) 0
+                : int * (_, report) worker_outcome * (int * int * int))
+            in
+            Buffer.clear w.result_buf;
+            w.in_flight <- None;
+            begin match outcome with
+            | Translated _ ->
+                Hashtbl.remove retained_bodies i;
+                (!Stats.stats)#addParseCounters parse_counters
+            | TranslationFailed | TranslationRaised _ -> ()
+            end;
+            Hashtbl.replace outcomes i outcome
+          end
+    in
+    (* Waits until at least one of [busy_workers] has sent something or died. *)
+    let await busy_workers =
+      match Unix.select (List.map (fun w -> w.result_fd) busy_workers) [] [] (-1.0) with
+      | readable, _, _ ->
+          busy_workers |> List.iter (fun w -> if List.mem w.result_fd readable then receive w)
+      | exception Unix.Unix_error (Unix.EINTR, _, _) -> ()
+    in
+    let rec idle_worker () =
+      match List.find_opt (fun w -> w.alive && w.in_flight = None) workers with
+      | Some w -> Some w
+      | None -> (
+          match List.filter (fun w -> w.alive) workers with
+          | [] -> None
+          | busy_workers ->
+              await busy_workers;
+              idle_worker ())
+    in
+    let dispatch body_cpn =
+      let i = !nb_bodies in
+      incr nb_bodies;
+      Hashtbl.replace retained_bodies i body_cpn;
+      match idle_worker () with
+      | None -> () (* All workers died; the body is translated in this process. *)
+      | Some w -> (
+          w.in_flight <- Some i;
+          try
+            Marshal.to_channel w.task_chn (i, body_cpn) [ Marshal.Closures ];
+            flush w.task_chn
+          with Sys_error _ -> worker_died w)
+    in
+    Fun.protect
+      ~finally:(fun () ->
+        workers
+        |> List.iter (fun w ->
+               close_out_noerr w.task_chn;
+               Unix.close w.result_fd;
+               ignore (Unix.waitpid [] w.pid)))
+      (fun () ->
+        List.iter dispatch bodies_cpn;
+        for _ = 1 to nb_streamed_bodies do
+          let body_cpn = read_streamed_body () in
+          if is_body_to_translate body_cpn then dispatch body_cpn
+        done;
+        let rec await_all () =
+          match List.filter (fun w -> w.alive && w.in_flight <> None) workers with
+          | [] -> ()
+          | busy_workers ->
+              await busy_workers;
+              await_all ()
+        in
+        await_all ());
+    let rec combine i bodies_tr_res =
+      if i = !nb_bodies then Ok (List.rev bodies_tr_res)
+      else
+        match Hashtbl.find_opt outcomes i with
+        | Some (Translated (body_tr_res, reports, name, seconds)) ->
+            List.iter replay_report reports;
+            (!Stats.stats)#recordBodyTranslationTiming name seconds;
+            combine (i + 1) (body_tr_res :: bodies_tr_res)
+        | outcome -> (
+            (* The translation failed or raised an exception, or the worker died; translate the body here. *)
+            let body_cpn = Hashtbl.find retained_bodies i in
+            let body_tr_res, seconds = translate_body_timed body_tr_defs_ctx body_cpn in
+            record_body_translation_timing body_cpn seconds;
+            match (outcome, body_tr_res) with
+            | Some (TranslationRaised exn), Ok _ ->
+                (* Translation is deterministic, so this is not expected to happen. *)
+                failwith
+                  (Printf.sprintf
+                     "Translating the body of %s raised exception %s in a worker process but not in the main process"
+                     (body_translation_name body_cpn) exn)
+            | _ ->
+                let* body_tr_res = body_tr_res in
+                combine (i + 1) (body_tr_res :: bodies_tr_res))
+    in
+    combine 0 []
+
+  (** [read_streamed_body ()] returns the next of the bodies that follow the VF MIR message in the exporter's output
+      (see the exporter's --vf-rust-mir-exporter:stream-bodies option), and [read_streamed_adt_defs ()] returns
+      the message that follows those bodies. *)
   let translate_vf_mir (extern_specs : string list)
-      (vf_mir_cpn : VfMirRd.VfMir.t) =
+      (vf_mir_cpn : VfMirRd.VfMir.t) (read_streamed_body : unit -> BodyRd.t)
+      (read_streamed_adt_defs : unit -> VfMirRd.StreamedAdtDefs.t) =
     let job _ =
       (* Todo @Nima: we should add necessary inclusions during translation *)
       let extern_header_names =
@@ -7581,14 +7827,79 @@ module Make (Args : VF_MIR_TRANSLATOR_ARGS) = struct
         in
         iter (Hashtbl.find_all fn_specialisations_table trait_fn)
       in
-      let adt_defs_cpn = VfMirRd.VfMir.adt_defs_get vf_mir_cpn in
-      let* adt_defs_cpn = CapnpAux.ind_list_get_list adt_defs_cpn in
-      let* adt_defs =
+      let translate_adt_defs adt_defs_cpn =
+        let* adt_defs_cpn = CapnpAux.ind_list_get_list adt_defs_cpn in
+        let* adt_defs =
+          ListAux.try_map
+            (translate_adt_def ghost_decl_map ghost_decls trait_impls)
+            adt_defs_cpn
+        in
+        Ok (List.filter_map Fun.id adt_defs)
+      in
+      (* The ADT definitions required only by streamed bodies follow those bodies; translating a body requires only
+         the ADT definitions of the self types of trait impls, which are in the VF MIR message. *)
+      let* header_adt_defs = translate_adt_defs (VfMirRd.VfMir.adt_defs_get vf_mir_cpn) in
+      let* ty_alias_decls = ListAux.try_map translate_ty_alias_decl (VfMirRd.VfMir.ty_aliases_get_list vf_mir_cpn) in
+      let* traits_cpn =
+        CapnpAux.ind_list_get_list (VfMirRd.VfMir.traits_get vf_mir_cpn)
+      in
+      let* traits_decls =
         ListAux.try_map
-          (translate_adt_def ghost_decl_map ghost_decls trait_impls)
-          adt_defs_cpn
+          (translate_trait header_adt_defs Args.skip_specless_fns)
+          traits_cpn
       in
-      let adt_defs = List.filter_map Fun.id adt_defs in
+      let traits_decls = List.flatten traits_decls in
+      (* It's okay to ignore closure bodies so long as we crash when we encounter closure types as function call generic arguments. *)
+      let is_body_to_translate body_cpn =
+        BodyRd.DefKind.get (BodyRd.def_kind_get body_cpn) <> BodyRd.DefKind.Closure
+        && (not Args.skip_specless_fns
+            || not
+                 (Capnp.Array.is_empty
+                    (ContractRd.annotations_get (BodyRd.contract_get body_cpn))))
+      in
+      let bodies_cpn =
+        List.filter is_body_to_translate (VfMirRd.VfMir.bodies_get_list vf_mir_cpn)
+      in
+      let body_tr_defs_ctx =
+        { adt_defs = header_adt_defs; directives = vf_mir_translator_directives; fn_specializer }
+      in
+      let translate_body body_cpn =
+        let body_tr_res, seconds = translate_body_timed body_tr_defs_ctx body_cpn in
+        record_body_translation_timing body_cpn seconds;
+        body_tr_res
+      in
+      let nb_streamed_bodies = VfMirRd.VfMir.streamed_bodies_get_int_exn vf_mir_cpn in
+      let jobs = !VF0.rust_translation_jobs in
+      let* bodies_tr_res =
+        if jobs > 1 && Sys.os_type <> "Win32"
+           && List.length bodies_cpn + nb_streamed_bodies >= 2 * jobs then
+          translate_bodies_in_parallel jobs body_tr_defs_ctx is_body_to_translate
+            bodies_cpn nb_streamed_bodies read_streamed_body
+        else
+          let* bodies_tr_res = ListAux.try_map translate_body bodies_cpn in
+          (* Streamed bodies are translated as they arrive, so that only one of them is held in memory in
+             undecoded form at a time. *)
+          let* streamed_bodies_tr_res =
+            let rec iter n bodies_tr_res =
+              if n = 0 then Ok (List.rev bodies_tr_res)
+              else
+                let body_cpn = read_streamed_body () in
+                if is_body_to_translate body_cpn then
+                  let* body_tr_res = translate_body body_cpn in
+                  iter (n - 1) (body_tr_res :: bodies_tr_res)
+                else iter (n - 1) bodies_tr_res
+            in
+            iter nb_streamed_bodies []
+          in
+          Ok (bodies_tr_res @ streamed_bodies_tr_res)
+      in
+      let* streamed_adt_defs =
+        if nb_streamed_bodies = 0 then Ok []
+        else translate_adt_defs (VfMirRd.StreamedAdtDefs.adt_defs_get (read_streamed_adt_defs ()))
+      in
+      (* The streamed ADT definitions may refer to the ones in the VF MIR message but not vice versa, so they go first;
+         see the reversal below. *)
+      let adt_defs = streamed_adt_defs @ header_adt_defs in
       (* Todo @Nima: External definitions and their corresponding ghost headers inclusion should be handled in a better way *)
       (* Todo @Nima: The MIR exporter encodes `ADT`s and adds the `ADT` declarations used in them later in the same array.
          For a Tree hierarchy of types just reversing the array works but obviously
@@ -7617,40 +7928,6 @@ module Make (Args : VF_MIR_TRANSLATOR_ARGS) = struct
         List.filter_map Fun.id adts_full_bor_content_preds
       in
       let* _ = check_proof_obligations ghost_decl_map adts_proof_obligs in
-      let* ty_alias_decls = ListAux.try_map translate_ty_alias_decl (VfMirRd.VfMir.ty_aliases_get_list vf_mir_cpn) in
-      let* traits_cpn =
-        CapnpAux.ind_list_get_list (VfMirRd.VfMir.traits_get vf_mir_cpn)
-      in
-      let* traits_decls =
-        ListAux.try_map
-          (translate_trait adt_defs Args.skip_specless_fns)
-          traits_cpn
-      in
-      let traits_decls = List.flatten traits_decls in
-      let bodies_cpn = VfMirRd.VfMir.bodies_get_list vf_mir_cpn in
-      let bodies_cpn =
-        bodies_cpn
-        |> List.filter (fun body_cpn ->
-               BodyRd.DefKind.get (BodyRd.def_kind_get body_cpn)
-               <> BodyRd.DefKind.Closure)
-      in
-      (* It's okay to ignore closure bodies so long as we crash when we encounter closure types as function call generic arguments. *)
-      let bodies_cpn =
-        if Args.skip_specless_fns then
-          List.filter
-            (fun body_cpn ->
-              not
-                (Capnp.Array.is_empty
-                   (ContractRd.annotations_get (BodyRd.contract_get body_cpn))))
-            bodies_cpn
-        else bodies_cpn
-      in
-      let body_tr_defs_ctx =
-        { adt_defs; directives = vf_mir_translator_directives; fn_specializer }
-      in
-      let* bodies_tr_res =
-        ListAux.try_map (translate_body body_tr_defs_ctx) bodies_cpn
-      in
       let body_sig_opts, body_decls, debug_infos =
         ListAux.split3 bodies_tr_res
       in
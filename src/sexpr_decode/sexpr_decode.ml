@@ -0,0 +1,30 @@
+(*
+  Reads a file written by verifast -emit_sexpr_binary and prints its s-expressions
+  in the text format written by -emit_sexpr.
+*)
+
+open SExpressions
+
+let () =
+  let path =
+    match Sys.argv with
+      [| _; path |] -> path
+    | _ -> prerr_endline "Usage: sexpr_decode file"; exit 2
+  in
+  let channel = open_in_bin path in
+  let header_length = String.length binary_format_header in
+  if in_channel_length channel < header_length || really_input_string channel header_length <> binary_format_header then begin
+    prerr_endline (path ^ ": not a binary s-expression file");
+    exit 1
+  end;
+  let formatter = Format.formatter_of_out_channel stdout in
+  Format.pp_set_margin formatter 160;
+  let rec iter () =
+    if pos_in channel < in_channel_length channel then begin
+      format_sexpression formatter (input_binary_sexpression channel);
+      print_string "\n";
+      iter ()
+    end
+  in
+  iter ();
+  close_in channel
@@ -12,6 +12,128 @@ let rec try_assoc k0 kvs =
   | (k, v)::kvs ->
     if k = k0 then Some v else try_assoc k0 kvs
 
+(* Rationals. Almost all coefficients and constants that arise in practice are
+   small; these are represented as a normalized pair of native ints (numerator,
+   positive denominator), small enough that the cross products computed by add,
+   mul, div, and compare do not overflow. Operations whose result does not fit
+   fall back to Num. *)
+module Q = struct
+
+  type t = Small of int * int | Big of num
+
+  let limit = 1 lsl ((Sys.int_size - 3) / 2)
+
+  let zero = Small (0, 1)
+  let one = Small (1, 1)
+  let minus_one = Small (-1, 1)
+
+  let rec gcd a b = if b = 0 then a else gcd b (a mod b)
+
+  let of_int n = if -limit < n && n < limit then Small (n, 1) else Big (num_of_int n)
+
+  (* [make n d] requires that [n] and [d] do not overflow. *)
+  let make n d =
+    if d = 0 then raise Division_by_zero;
+    let n, d = if d < 0 then -n, -d else n, d in
+    let g = gcd (abs n) d in
+    let n, d = if g = 1 then n, d else n / g, d / g in
+    if -limit < n && n < limit && d < limit then Small (n, d) else Big (num_of_int n // num_of_int d)
+
+  let to_num q =
+    match q with
+      Small (n, 1) -> num_of_int n
+    | Small (n, d) -> num_of_int n // num_of_int d
+    | Big q -> q
+
+  let of_num q =
+    match q with
+      Int n -> of_int n
+    | Big_int n -> if is_int_big_int n then of_int (int_of_big_int n) else Big q
+    | Ratio r ->
+      let r = Ratio.normalize_ratio r in
+      let n = Ratio.numerator_ratio r in
+      let d = Ratio.denominator_ratio r in
+      if is_int_big_int n && is_int_big_int d then
+        let n = int_of_big_int n in
+        let d = int_of_big_int d in
+        if -limit < n && n < limit && d < limit then Small (n, d) else Big q
+      else
+        Big q
+
+  let add a b =
+    match a, b with
+      Small (n1, 1), Small (n2, 1) -> of_int (n1 + n2)
+    | Small (n1, d1), Small (n2, d2) -> make (n1 * d2 + n2 * d1) (d1 * d2)
+    | _ -> of_num (to_num a +/ to_num b)
+
+  let mul a b =
+    match a, b with
+      Small (n1, d1), Small (n2, d2) -> make (n1 * n2) (d1 * d2)
+    | _ -> of_num (to_num a */ to_num b)
+
+  let div a b =
+    match a, b with
+      Small (n1, d1), Small (n2, d2) -> make (n1 * d2) (d1 * n2)
+    | _ -> of_num (to_num a // to_num b)
+
+  let neg a =
+    match a with
+      Small (n, d) -> Small (-n, d)
+    | Big q -> Big (minus_num q)
+
+  let abs a =
+    match a with
+      Small (n, d) -> Small (abs n, d)
+    | Big q -> Big (abs_num q)
+
+  let sign a =
+    match a with
+      Small (n, _) -> Stdlib.compare n 0
+    | Big q -> sign_num q
+
+  let compare a b =
+    match a, b with
+      Small (n1, d1), Small (n2, d2) -> Stdlib.compare (n1 * d2) (n2 * d1)
+    | _ -> compare_num (to_num a) (to_num b)
+
+  let eq a b =
+    match a, b with
+      Small (n1, d1), Small (n2, d2) -> n1 = n2 && d1 = d2
+    | _ -> compare a b = 0
+
+  let to_string a = string_of_num (to_num a)
+
+end
+
+(* Trail-based undo. Each mutable field of the tableau is a cell. The first
+   time a cell is written after a push, its old value is saved in the cell and
+   the cell is recorded on the trail; a pop restores the cells recorded since
+   the matching push. A cell that is written repeatedly between a push and a
+   pop, such as a coefficient updated by successive pivots, is saved only once. *)
+type 'a cell = {mutable current: 'a; mutable saved_level: int; mutable saved: (int * 'a) list}
+
+type trail_entry = Trailed: 'a cell -> trail_entry
+
+type trail = {mutable level: int; mutable entries: trail_entry list}
+
+let new_cell trail v = {current = v; saved_level = trail.level; saved = []}
+
+let set_cell trail c v =
+  if c.saved_level < trail.level then begin
+    c.saved <- (c.saved_level, c.current)::c.saved;
+    c.saved_level <- trail.level;
+    trail.entries <- Trailed c::trail.entries
+  end;
+  c.current <- v
+
+let restore_cell (Trailed c) =
+  match c.saved with
+    [] -> assert false
+  | (level, v)::saved ->
+    c.current <- v;
+    c.saved_level <- level;
+    c.saved <- saved
+
 type ('a, 'b) unknown_pos =
   Row of 'a | Column of 'b
   
@@ -19,112 +141,98 @@ type result = Sat | Unsat
 
 class ['tag] unknown (context: 'tag simplex) (name: string) (restricted: bool) (tag: 'tag option) (nonzero: bool) =
   object (self)
-    val mutable pos: ('tag row, 'tag column) unknown_pos option = None
+    val pos: ('tag row, 'tag column) unknown_pos option cell = new_cell context#trail None
     
     method name = name
     method tag = tag
     method restricted = restricted
     method nonzero = nonzero
-    method set_pos p =
-      let oldpos = pos in
-      context#register_popaction (fun () -> pos <- oldpos);
-      pos <- Some p
-    method pos = match pos with None -> assert false | Some pos -> pos
-    method dead = match pos with None -> false | Some (Row row) -> row#closed | Some (Column col) -> col#dead
+    method set_pos p = set_cell context#trail pos (Some p)
+    method pos = match pos.current with None -> assert false | Some pos -> pos
+    method dead = match pos.current with None -> false | Some (Row row) -> row#closed | Some (Column col) -> col#dead
     method print =
       if restricted then "[" ^ name ^ "]" else name
   end
 and ['tag] coeff (context: 'tag simplex) v =
   object (self)
-    val mutable value: num = v
+    val value: Q.t cell = new_cell context#trail v
     
-    method value = value
-    method set_value_no_undo v = value <- v
-    method set_value v =
-      let oldvalue = value in
-      context#register_popaction (fun () -> value <- oldvalue);
-      value <- v
-    method add a = self#set_value (value +/ a)
-    method divide_by a = self#set_value (value // a)
+    method value = value.current
+    method set_value_no_undo v = value.current <- v
+    method set_value v = set_cell context#trail value v
+    method add a = self#set_value (Q.add value.current a)
+    method divide_by a = self#set_value (Q.div value.current a)
   end
 and ['tag] row context own c =
   object (self)
-    val mutable owner: 'tag unknown = own
-    val mutable constant: num = c
-    val mutable terms: ('tag column * 'tag coeff) list = []
-    val mutable closed: bool = false
+    val owner: 'tag unknown cell = new_cell context#trail own
+    val constant: Q.t cell = new_cell context#trail c
+    val terms: ('tag column * 'tag coeff) list cell = new_cell context#trail []
+    val closed: bool cell = new_cell context#trail false
 
     method print =
       let print_term (coef, col) =
         match col with
-          None -> string_of_num coef
+          None -> Q.to_string coef
         | Some col ->
-          if eq_num coef (num_of_int 1) then col else
-          if eq_num coef (num_of_int (-1)) then "-" ^ col else
-          string_of_num coef ^ "*" ^ col
+          if Q.eq coef Q.one then col else
+          if Q.eq coef Q.minus_one then "-" ^ col else
+          Q.to_string coef ^ "*" ^ col
       in
       let print_sum terms =
-        let terms = List.filter (fun (coef, col) -> sign_num coef <> 0) terms in
+        let terms = List.filter (fun (coef, col) -> Q.sign coef <> 0) terms in
         match terms with
           [] -> "0"
         | term::terms ->
           print_term term ^
-          String.concat "" (List.map (fun (coef, col) -> if sign_num coef < 0 then " - " ^ print_term (minus_num coef, col) else " + " ^ print_term (coef, col)) terms)
+          String.concat "" (List.map (fun (coef, col) -> if Q.sign coef < 0 then " - " ^ print_term (Q.neg coef, col) else " + " ^ print_term (coef, col)) terms)
       in
-      owner#print ^ " = " ^ print_sum ((constant, None)::flatmap (fun (col, coef) -> if col#dead then [] else [coef#value, Some col#owner#print]) terms)
-    method constant = constant
-    method owner = owner
-    method closed = closed
-    method set_owner u =
-      let oldowner = owner in
-      context#register_popaction (fun () -> owner <- oldowner);
-      owner <- u
-    method terms = terms
-    method set_constant_no_undo v = constant <- v
-    method set_constant v =
-      let oldconstant = constant in
-      context#register_popaction (fun () -> constant <- oldconstant);
-      constant <- v
+      owner.current#print ^ " = " ^ print_sum ((constant.current, None)::flatmap (fun (col, coef) -> if col#dead then [] else [coef#value, Some col#owner#print]) terms.current)
+    method constant = constant.current
+    method owner = owner.current
+    method closed = closed.current
+    method set_owner u = set_cell context#trail owner u
+    method terms = terms.current
+    method set_constant_no_undo v = constant.current <- v
+    method set_constant v = set_cell context#trail constant v
     method add_row a r =
-      self#set_constant (constant +/ (r#constant */ a));
-      List.iter (fun (col, b) -> self#add (b#value */ a) col) r#terms
-    method set_terms ts =
-      let oldterms = terms in
-      context#register_popaction (fun () -> terms <- oldterms);
-      terms <- ts
+      self#set_constant (Q.add constant.current (Q.mul r#constant a));
+      List.iter (fun (col, b) -> self#add (Q.mul b#value a) col) r#terms
+    method set_terms ts = set_cell context#trail terms ts
     method add a col =
-      match try_assoc col terms with
-        None -> let coef = new coeff context a in self#set_terms ((col, coef)::terms); col#term_added (self :> 'tag row) coef
+      match try_assoc col terms.current with
+        None -> let coef = new coeff context a in self#set_terms ((col, coef)::terms.current); col#term_added (self :> 'tag row) coef
       | Some coef -> coef#add a
         
     method solve_for column =
-      let c0 = minus_num (List.assoc column terms)#value in
-      self#set_constant (constant // c0);
+      let c0 = Q.neg (List.assoc column terms.current)#value in
+      self#set_constant (Q.div constant.current c0);
       List.iter
         (fun (col, coef) ->
            if col = column then
-             coef#set_value (num_of_int (-1) // c0)
+             coef#set_value (Q.div Q.minus_one c0)
            else
              coef#divide_by c0
         )
-        terms
+        terms.current
     
     method close enqueue =
-      assert (not closed);
-      context#register_popaction (fun () -> closed <- false);
-      closed <- true;
-      List.iter (fun (col, coef) -> if not col#dead && sign_num coef#value < 0 then col#die enqueue) terms
+      assert (not closed.current);
+      set_cell context#trail closed true;
+      List.iter (fun (col, coef) -> if not col#dead && Q.sign coef#value < 0 then col#die enqueue) terms.current
     
     method live_terms =
-      List.filter (fun (col, coef) -> not col#dead && sign_num coef#value <> 0) terms
+      List.filter (fun (col, coef) -> not col#dead && Q.sign coef#value <> 0) terms.current
 
     method propagate_eq =
+      let owner = owner.current in
+      let constant = constant.current in
       let live_terms = self#live_terms in
       begin
         match live_terms with
           [(col, coef)] ->
-          if owner#tag <> None && col#owner#tag <> None && sign_num constant = 0 && coef#value =/ num_of_int 1 then context#propagate_equality owner col#owner
-        | [] -> if owner#tag <> None then context#propagate_eq_constant owner constant else if owner#nonzero && sign_num constant = 0 then context#set_unsat
+          if owner#tag <> None && col#owner#tag <> None && Q.sign constant = 0 && Q.eq coef#value Q.one then context#propagate_equality owner col#owner
+        | [] -> if owner#tag <> None then context#propagate_eq_constant owner constant else if owner#nonzero && Q.sign constant = 0 then context#set_unsat
         | _ -> ()
       end;
       if owner#tag <> None && not context#unsat then begin
@@ -132,7 +240,7 @@ and ['tag] row context own c =
           [] -> ()
         | (col0, coef0)::_ ->
           let row_equals (c1, ts1) (c2, ts2) =
-            c1 =/ c2 &&
+            Q.eq c1 c2 &&
             List.length ts1 = List.length ts2 &&
             let rec iter ts =
               match ts with
@@ -141,7 +249,7 @@ and ['tag] row context own c =
                 begin
                 match try_assoc col0 ts2 with
                   None -> false
-                | Some coef1 -> coef0#value =/ coef1#value && iter ts
+                | Some coef1 -> Q.eq coef0#value coef1#value && iter ts
                 end
             in
             iter ts1
@@ -151,7 +259,7 @@ and ['tag] row context own c =
                if
                  row <> (self :> 'tag row) &&
                  row#owner#tag <> None &&
-                 coef0#value =/ coef1#value &&
+                 Q.eq coef0#value coef1#value &&
                  row_equals (constant, live_terms) (row#constant, row#live_terms)
                then
                  context#propagate_equality owner row#owner
@@ -161,32 +269,26 @@ and ['tag] row context own c =
   end
 and ['tag] column context own =
   object (self)
-    val mutable owner: 'tag unknown = own
-    val mutable terms: ('tag row * 'tag coeff) list = []
-    val mutable dead: bool = false
+    val owner: 'tag unknown cell = new_cell context#trail own
+    val terms: ('tag row * 'tag coeff) list cell = new_cell context#trail []
+    val dead: bool cell = new_cell context#trail false
     
-    method owner = owner
-    method set_owner u =
-      let oldowner = owner in
-      context#register_popaction (fun () -> owner <- oldowner);
-      owner <- u
-    method terms = terms
-    method term_added row coef =
-      let oldterms = terms in
-      context#register_popaction (fun () -> terms <- oldterms);
-      terms <- (row, coef)::terms
-    method dead = dead
+    method owner = owner.current
+    method set_owner u = set_cell context#trail owner u
+    method terms = terms.current
+    method term_added row coef = set_cell context#trail terms ((row, coef)::terms.current)
+    method dead = dead.current
     
     method die enqueue =
-      assert (not dead);
-      context#register_popaction (fun () -> dead <- false);
-      dead <- true;
+      assert (not dead.current);
+      set_cell context#trail dead true;
+      let owner = owner.current in
       if owner#nonzero then context#set_unsat else
       begin
       if owner#tag <> None then
-        context#propagate_eq_constant owner (num_of_int 0);
-      List.iter (fun (row, coef) -> if (row#owner#tag <> None || row#owner#nonzero) && sign_num coef#value <> 0 then row#propagate_eq) terms;
-      List.iter (fun (row, coef) -> if row#owner#restricted && sign_num coef#value > 0 then enqueue row#owner) terms
+        context#propagate_eq_constant owner Q.zero;
+      List.iter (fun (row, coef) -> if (row#owner#tag <> None || row#owner#nonzero) && Q.sign coef#value <> 0 then row#propagate_eq) terms.current;
+      List.iter (fun (row, coef) -> if row#owner#restricted && Q.sign coef#value > 0 then enqueue row#owner) terms.current
       end
   end
 and ['tag] simplex () =
@@ -197,7 +299,7 @@ and ['tag] simplex () =
     val mutable unsat: bool = false
     val mutable rows: 'tag row list = []
     val mutable columns: 'tag column list = []
-    val mutable popactions: (unit -> unit) list = []
+    val trail: trail = {level = 0; entries = []}
     val mutable popstack = []
     
     method unsat = unsat
@@ -207,22 +309,28 @@ and ['tag] simplex () =
       eq_listener <- feqs;
       const_listener <- fconsts
 
-    method register_popaction f = popactions <- f::popactions
+    method trail = trail
     method push =
       assert (not unsat);
-      popstack <- (rows, columns, popactions)::popstack;
-      popactions <- []
+      popstack <- (rows, columns, trail.entries)::popstack;
+      trail.level <- trail.level + 1
     method pop =
-      List.iter (fun f -> f()) popactions;
       match popstack with
         [] -> assert false
-      | (oldrows, oldcolumns, oldpopactions)::oldpopstack ->
+      | (oldrows, oldcolumns, oldentries)::oldpopstack ->
+        let rec undo entries =
+          if entries != oldentries then
+            match entries with
+              [] -> assert false
+            | entry::entries -> restore_cell entry; undo entries
+        in
+        undo trail.entries;
+        trail.entries <- oldentries;
+        trail.level <- trail.level - 1;
         unsat <- false;
         rows <- oldrows;
         columns <- oldcolumns;
-        popactions <- oldpopactions;
         popstack <- oldpopstack
-
     method get_unique_index () =
       let u = uniqueCounter in
       uniqueCounter <- u + 1;
@@ -246,7 +354,7 @@ and ['tag] simplex () =
              ()
            else
              let v = coef#value in
-             coef#set_value (num_of_int 0);
+             coef#set_value Q.zero;
              r#add_row v row
         )
         col#terms
@@ -263,13 +371,13 @@ and ['tag] simplex () =
         match ts with
           [] -> cand
         | (r, coef)::ts ->
-          if r#owner#restricted && sign_num coef#value * sign < 0 then
-            let delta = r#constant // abs_num coef#value in
+          if r#owner#restricted && Q.sign coef#value * sign < 0 then
+            let delta = Q.div r#constant (Q.abs coef#value) in
             let new_cand =
               match cand with
                 None -> Some (r, delta)
               | Some (r', delta') ->
-                if delta' <=/ delta then Some (r', delta') else Some (r, delta)
+                if Q.compare delta' delta <= 0 then Some (r', delta') else Some (r, delta)
             in
             iter new_cand ts
           else
@@ -292,7 +400,7 @@ and ['tag] simplex () =
 
     method sign_of_max_of_row pivotListener row =
       let rec maximize_row () =
-        if sign_num row#constant > 0 then
+        if Q.sign row#constant > 0 then
           1
         else
         begin
@@ -304,14 +412,14 @@ and ['tag] simplex () =
               if col#dead then
                 find_pivot_col ts
               else
-                let sign = sign_num coef#value in
+                let sign = Q.sign coef#value in
                 if sign <> 0 && (not col#owner#restricted || sign > 0) then
                   Some (col, sign)
                 else
                   find_pivot_col ts
           in
           match find_pivot_col row#terms with
-            None -> (* row is manifestly maximized  *) sign_num row#constant  
+            None -> (* row is manifestly maximized  *) Q.sign row#constant  
           | Some (col, sign) ->
             match self#find_pivot_row sign col with
               None ->
@@ -329,7 +437,7 @@ and ['tag] simplex () =
       eq_listener u1 u2
 
     method propagate_eq_constant u n =
-      const_listener u n
+      const_listener u (Q.to_num n)
       
     method close_row row =
       let queue: 'tag unknown list ref = ref [] in
@@ -353,16 +461,16 @@ and ['tag] simplex () =
     (* fac: formal affine combination *)
     method row_for_fac (c: num) (ts: (num * 'tag unknown) list) =
       let y = new unknown (self :> 'tag simplex) ("r" ^ string_of_int (self#get_unique_index())) true None false in
-      let row = new row (self :> 'tag simplex) y c in
+      let row = new row (self :> 'tag simplex) y (Q.of_num c) in
       rows <- row::rows;
       y#set_pos (Row row);
       List.iter
         (fun (a, u) ->
            match u#pos with
              Row r ->
-             row#add_row a r
+             row#add_row (Q.of_num a) r
            | Column col ->
-             row#add a col
+             row#add (Q.of_num a) col
         )
         ts;
       row
@@ -395,10 +503,10 @@ and ['tag] simplex () =
         | 1 ->
         begin match u#pos with
           Column col ->
-          List.iter (fun (row, coef) -> coef#set_value_no_undo (minus_num coef#value)) col#terms
+          List.iter (fun (row, coef) -> coef#set_value_no_undo (Q.neg coef#value)) col#terms
         | Row row ->
-          row#set_constant_no_undo (minus_num row#constant);
-          List.iter (fun (col, coef) -> coef#set_value_no_undo (minus_num coef#value)) row#terms
+          row#set_constant_no_undo (Q.neg row#constant);
+          List.iter (fun (col, coef) -> coef#set_value_no_undo (Q.neg coef#value)) row#terms
         end;
         let pivotCol = ref None in
         let pivotListener row column = pivotCol := Some column in
@@ -446,6 +446,7 @@ module type STATEMENT = sig
   type term
 
   val set_logic : string -> t
+  val set_option : string -> string -> t
   val declare_fun : symbol -> t
   val declare_sort : sort -> t
   val sassert : term -> t
@@ -472,6 +473,7 @@ module Statement
 
   type t =
     | SetLogic of string
+    | SetOption of string * string
     | SortDecl of sort
     | FunDecl of symbol
     | Assert of term
@@ -481,6 +483,7 @@ module Statement
     | CheckSat
 
   let set_logic s = SetLogic s
+  let set_option name value = SetOption (name, value)
   let declare_sort s = SortDecl s
   let declare_fun f = FunDecl f
   let sassert t = Assert t
@@ -494,6 +497,8 @@ module Statement
   let print o : t -> unit = function
     | SetLogic s ->
        Format.fprintf o "@[<3>(set-logic %s)@]" s
+    | SetOption (name, value) ->
+       Format.fprintf o "@[<3>(set-option :%s@ %s)@]" name value
     | SortDecl s ->
        Format.fprintf o "@[<3>(declare-sort@ %a@ 0)@]" S.print s
     | FunDecl f ->
@@ -515,6 +520,8 @@ module Statement
   let to_string = function
     | SetLogic s ->
        Printf.sprintf "(set-logic %s)" s
+    | SetOption (name, value) ->
+       Printf.sprintf "(set-option :%s %s)" name value
     | SortDecl s ->
        Printf.sprintf "(declare-sort %s)" (S.to_string s)
     | FunDecl f ->
@@ -533,7 +540,7 @@ module Statement
     | CheckSat -> "(check-sat)"
 
   let features = function
-    | SetLogic _ | Comment _ | CheckSat -> []
+    | SetLogic _ | SetOption _ | Comment _ | CheckSat -> []
     | Push | Pop _ -> ["I"]
     | Assert t -> T.features t
     | SortDecl s -> S.features s
@@ -546,6 +553,7 @@ module St = Statement(Sort)(Sym)(Var)(T)
 type statement = St.t
 let print_statement = St.print
 let set_logic s = St.set_logic s
+let set_option = St.set_option
 let declare_fun = St.declare_fun
 let declare_sort = St.declare_sort
 let sassert t = St.sassert t
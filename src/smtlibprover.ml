@@ -14,14 +14,17 @@ open Proverapi
 
 (* This code is largely inspired from the modules for the Z3 prover. *)
 
-class smtlib_context input_fun output (features : string list) =
-  let statements : Smtlib.statement list ref = ref [] in
+(* [input_fun timeout] reads the prover's next answer. If [timeout] is [Some t] and no answer arrives
+   within [t] seconds, it returns [None]. [options] are sent to the prover using set-option. *)
+class smtlib_context ?(options = []) input_fun output (features : string list) =
   let dump_fmt = Format.formatter_of_out_channel output in
+  (* Statements are buffered; they are sent to the prover only when an answer is needed (see
+     flush_statements), so that a session costs one pipe round trip per check-sat rather than one
+     write per statement. *)
   let add_statement st =
-    Format.fprintf dump_fmt "%a@\n" Smtlib.print_statement st;
-    flush output;
-    statements := st :: !statements
+    Format.fprintf dump_fmt "%a@\n" Smtlib.print_statement st
   in
+  let flush_statements () = Format.pp_print_flush dump_fmt () in
   let has_features l =
     List.for_all (fun f -> List.mem f features) l
   in
@@ -40,6 +43,7 @@ class smtlib_context input_fun output (features : string list) =
      non-linear arithmetic is not often used and maybe it makes the
      SMT solver slow. *)
   let () = add_statement (Smtlib.set_logic "ALL") in
+  let () = options |> List.iter (fun (name, value) -> add_statement (Smtlib.set_option name value)) in
   let bool_type = Smtlib.bool in
   let int_type = Smtlib.int in
   let real_type = Smtlib.real in
@@ -68,11 +72,24 @@ class smtlib_context input_fun output (features : string list) =
      until we add an assertion or pop the stack. We do that to avoid
      asking the prover the same question several times. *)
   let last_prover_answer = ref None in
+  (* The number of check-sat statements sent and the number of answers read. They differ only if an
+     asynchronous query (see start_query) was not awaited or timed out. *)
+  let answers_requested = ref 0 in
+  let answers_read = ref 0 in
+  let last_answer = ref Unknown in
+  let read_answer timeout =
+    match input_fun timeout with
+    | None -> false
+    | Some ans -> incr answers_read; last_answer := ans; true
+  in
   let check () =
     match !last_prover_answer with
     | None ->
        add_statement Smtlib.check_sat;
-       input_fun ()
+       flush_statements ();
+       incr answers_requested;
+       while !answers_read < !answers_requested do ignore (read_answer None) done;
+       !last_answer
     | Some ans -> ans
   in
   let add_assert t =
@@ -112,9 +129,48 @@ class smtlib_context input_fun output (features : string list) =
   let unboxed_real = declare_fun "unbox_real" [ inductive_type ] real_type in
   let () = assume_is_inverse unboxed_real boxed_real real_type in
   let () = assume_is_inverse boxed_real unboxed_real inductive_type in
+  (* Sends the query without waiting for the answer. The returned function waits for the answer until
+     [timeout] seconds after the query was sent; it returns [None] if no answer arrived in time.
+     The prover answers check-sat statements in order, so a query sent while it is still working on
+     an earlier one whose answer was not awaited would only start when that one finishes, and its
+     deadline would be spent waiting in line. Such a query is therefore not sent at all; the returned
+     function then returns [None] right away. This keeps at most one unanswered query at the prover,
+     and makes [timeout] count from the moment the prover starts on the query. *)
+  let start_query timeout t =
+    while !answers_read < !answers_requested && read_answer (Some 0.0) do () done;
+    if !answers_read < !answers_requested then
+      fun () -> None
+    else if has_features (Smtlib.T.features t) then
+      begin
+        add_statement Smtlib.push;
+        add_statement (Smtlib.sassert (Smtlib.tnot t));
+        add_statement Smtlib.check_sat;
+        add_statement (Smtlib.pop 1);
+        flush_statements ();
+        last_prover_answer := None;
+        incr answers_requested;
+        let ticket = !answers_requested in
+        let deadline = Unix.gettimeofday () +. timeout in
+        let rec await () =
+          if !answers_read = ticket then Some (!last_answer = Unsat)
+          else if !answers_read > ticket then None
+          else
+            let remaining = deadline -. Unix.gettimeofday () in
+            if remaining > 0.0 && read_answer (Some remaining) then await () else None
+        in
+        await
+      end
+    else
+      fun () -> Some false
+  in
   object
     val mutable verbosity = 0
     method features = features
+    method flush_statements = flush_statements ()
+    method start_query timeout t =
+      add_statement
+        (Smtlib.comment (Printf.sprintf "Query: %s" (Smtlib.T.to_string t)));
+      start_query timeout t
     method set_verbosity v = verbosity <- v
     method type_bool = bool_type
     method type_int = int_type
@@ -252,6 +308,7 @@ class smtlib_context input_fun output (features : string list) =
     method pop = last_prover_answer := None; add_statement (Smtlib.pop 1)
     method perform_pending_splits (cont: Smtlib.term list -> bool) = cont []
     method stats: string * (string * int64) list = "(no statistiques for SMTlib)", []
+    method counters: (string * int) list = []
     method begin_formal = ()
     method end_formal = ()
     method mk_bound (i: int) (tp: Smtlib.sort) =
@@ -270,20 +327,62 @@ class smtlib_context input_fun output (features : string list) =
   end
 
 let dump_smtlib_ctxt filename features =
-  (new smtlib_context
-     (fun _ -> Unknown)
-     (open_out filename)
-     features
-   : smtlib_context :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context)
+  let output = open_out filename in
+  let ctxt = new smtlib_context (fun _ -> Some Unknown) output features in
+  (* Statements that follow the last check-sat are still buffered at exit. *)
+  at_exit (fun () -> ctxt#flush_statements; close_out_noerr output);
+  (ctxt : smtlib_context :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context)
+
+(* Returns a function that reads the prover's next answer from [input]. The answers are read
+   directly from the underlying file descriptor, in chunks, so that Unix.select can tell whether an
+   answer is available; see smtlib_context for the meaning of the timeout argument. *)
+let answer_reader input =
+  let fd = Unix.descr_of_in_channel input in
+  let pending = Buffer.create 64 in
+  let chunk = Bytes.create 4096 in
+  let rec read_line timeout =
+    match String.index_opt (Buffer.contents pending) '\n' with
+    | Some i ->
+       let contents = Buffer.contents pending in
+       Buffer.clear pending;
+       Buffer.add_string pending (String.sub contents (i + 1) (String.length contents - i - 1));
+       Some (String.trim (String.sub contents 0 i))
+    | None ->
+       let ready =
+         match timeout with
+         | None -> true
+         | Some t -> let (readable, _, _) = Unix.select [fd] [] [] t in readable <> []
+       in
+       if not ready then None else
+       let n = Unix.read fd chunk 0 (Bytes.length chunk) in
+       if n = 0 then failwith "The SMT solver process terminated unexpectedly";
+       Buffer.add_subbytes pending chunk 0 n;
+       read_line timeout
+  in
+  fun timeout ->
+    match read_line timeout with
+    | None -> None
+    | Some "unsat" -> Some Unsat
+    | Some ("sat" | "unknown") -> Some Unknown
+    | Some answer -> failwith ("Unexpected answer from the SMT solver: " ^ answer)
 
 let external_smtlib_ctxt command features =
   let (input, output) = Unix.open_process command in
   (new smtlib_context
-     (fun _ ->
-       match input_line input with
-       | "unsat" -> Unsat
-       | "unknown" -> Unknown
-       | _ -> assert false)
+     (answer_reader input)
      output
      features
    : smtlib_context :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context)
+
+(* Like external_smtlib_ctxt, but each query is given [timeout] seconds, and queries can also be
+   asked asynchronously, using the returned start_query function (see Combineprovers.Race). *)
+let racing_smtlib_ctxt command features timeout =
+  let (input, output) = Unix.open_process command in
+  let ctxt =
+    new smtlib_context
+      ~options:["timeout", string_of_int (int_of_float (timeout *. 1000.0))]
+      (answer_reader input)
+      output
+      features
+  in
+  ((ctxt :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context), ctxt#start_query timeout)
@@ -1122,11 +1122,70 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       end;
       let w = check_condition (pn,ilist) tparams tenv e in
       let tcont _ _ _ h env = tcont sizemap tenv ghostenv h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) in
+      (* Path merging (-merge_paths): if both branches only assign side-effect-free expressions over
+         non-address-taken locals to non-address-taken locals, both branches are verified (so that e.g. overflow
+         checks are performed under the branch condition), but the rest of the function is verified only once,
+         in a state where each assigned variable has value (w ? v1 : v2). The branches leave the heap unchanged,
+         so the heaps trivially agree. *)
+      let local_var x = match try_assoc x tenv with Some (RefType _) | None -> false | Some _ -> true in
+      (* The merged values are re-evaluated in ghost mode, which does not assume the facts that evaluating
+         bitwise and shift operators in real code assumes about their results (e.g. their bounds), so
+         those operators are not merged. *)
+      let rec is_simple_expr e =
+        match e with
+          Var (_, x) -> local_var x
+        | True _ | False _ | IntLit _ -> true
+        | Operation (_, (Add|Sub|Mul|Eq|Neq|Le|Lt|Ge|Gt|And|Or|Not), es) -> List.for_all is_simple_expr es
+        | IfExpr (_, e1, e2, e3) -> is_simple_expr e1 && is_simple_expr e2 && is_simple_expr e3
+        | _ -> false
+      in
+      let simple_assignments ss =
+        let rec iter assignments ss =
+          match ss with
+            [] -> Some (List.rev assignments)
+          | ExprStmt (AssignExpr (_, Var (_, x), _, rhs))::ss when local_var x && is_simple_expr rhs -> iter ((x, rhs)::assignments) ss
+          | _ -> None
+        in
+        iter [] ss
+      in
+      begin match if options.option_merge_paths then simple_assignments ss1, simple_assignments ss2 else None, None with
+        Some assignments1, Some assignments2 ->
+        eval_h_nonpure h env w $. fun h env w ->
+        let verify_branch ss = verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss (fun _ _ _ _ _ -> SymExecSuccess) return_cont econt in
+        ignore (branch
+          (fun _ -> assume w (fun _ -> verify_branch ss1))
+          (fun _ -> assume (ctxt#mk_not w) (fun _ -> verify_branch ss2)));
+        let env_after assignments =
+          assignments |> List.fold_left begin fun env (x, rhs) ->
+            let w = check_expr_t (pn,ilist) tparams tenv rhs (List.assoc x tenv) in
+            (x, eval None env w)::env
+          end env
+        in
+        let env1 = env_after assignments1 in
+        let env2 = env_after assignments2 in
+        let assigned = List.sort_uniq compare (List.map fst assignments1 @ List.map fst assignments2) in
+        let merged_env =
+          assigned |> List.fold_left begin fun env x ->
+            let v1 = List.assoc x env1 in
+            let v2 = List.assoc x env2 in
+            let v =
+              if v1 == v2 then v1 else
+              match List.assoc x tenv with
+                Bool -> ctxt#mk_or (ctxt#mk_and w v1) (ctxt#mk_and (ctxt#mk_not w) v2)
+              | _ -> ctxt#mk_ifthenelse w v1 v2
+            in
+            (x, v)::env
+          end env
+        in
+        !stats#pathsMerged;
+        tcont sizemap tenv ghostenv h merged_env
+      | _ ->
       (eval_h_nonpure h env w ( fun h env w ->
         branch
           (fun _ -> assume w (fun _ -> verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss1 tcont return_cont econt))
           (fun _ -> assume (ctxt#mk_not w) (fun _ -> verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss2 tcont return_cont econt))
       ))
+      end
     | SwitchStmt (l, e, cs) ->
       let sizemap = match e with 
         | Var (_, x) ->
@@ -3578,6 +3637,46 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     let result = body () in
     !stats#recordFunctionTiming (string_of_loc l ^ ": " ^ funName) (Perf.time() -. time0);
     result
+
+  (** Runs [body], which verifies function [funName], within the per-function budgets (see option_max_steps_per_function).
+      If a budget is exceeded, records this in the statistics, restores the symbolic execution state, and returns None. *)
+  let with_function_budget l funName body =
+    if not budgets_enabled then Some (body ()) else begin
+      function_steps_left := (match options.option_max_steps_per_function with None -> max_int | Some n -> n);
+      function_prover_deadline :=
+        begin match options.option_max_prover_seconds_per_function with
+          None -> Int64.max_int
+        | Some seconds -> Int64.add (Stopwatch.ticks Redux.stopwatch) (Int64.of_float (seconds /. !stats#tickLength))
+        end;
+      Hashtbl.reset function_line_steps;
+      let usedIdsStack = !used_ids_stack in
+      let proverPushDepth = !prover_push_depth in
+      let forest = !currentForest in
+      let recursionDepth = !consume_chunk_recursion_depth in
+      let tparamEqsTable, tparamEqsTablesStack = !tparam_eqs_table, !tparam_eqs_tables_stack in
+      let result =
+        match body () with
+          result -> Some result
+        | exception FunctionBudgetExceeded budget ->
+          while !used_ids_stack != usedIdsStack do pop () done;
+          (* Close the scopes of the assumptions that were active when the budget was exceeded. *)
+          while !prover_push_depth > proverPushDepth do decr prover_push_depth; ctxt#pop done;
+          currentForest := forest;
+          consume_chunk_recursion_depth := recursionDepth;
+          tparam_eqs_table := tparamEqsTable;
+          tparam_eqs_tables_stack := tparamEqsTablesStack;
+          let hottestLines =
+            Hashtbl.fold (fun (path, line) count lines -> (path ^ ":" ^ string_of_int line, !count)::lines) function_line_steps []
+            |> List.sort (fun (_, count1) (_, count2) -> compare count2 count1)
+            |> take 5
+          in
+          !stats#functionBudgetExceeded (string_of_loc l ^ ": " ^ funName) budget hottestLines;
+          None
+      in
+      function_steps_left := max_int;
+      function_prover_deadline := Int64.max_int;
+      result
+    end
   
   let rec verify_exceptional_return (pn,ilist) l h ghostenv env exceptp excep handlers =
     if not (is_unchecked_exception_type exceptp) then
@@ -3784,6 +3883,15 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       verify_meths (cpn, cilist) cfinal cabstract boxes lems cmeths ctpenv;
       verify_classes boxes lems classm
   
+  (* The cache is not used if a manifest is emitted or checked, since this relies on side effects of verifying
+     each function, nor if only part of the program is verified (-focus, -breakpoint, -break_at_node), since
+     functions that were skipped or stopped early must not be recorded as verified. *)
+  let verification_cache =
+    if options.option_incremental && focus = None && breakpoint = None && targetPath = None && not emit_manifest && not check_manifest && not is_import_spec && filepath = !current_program_path then
+      Some (Verification_cache.create filepath (Digest.to_hex (Digest.string (Marshal.to_string options []))) (List.map fst !headermap) ps)
+    else
+      None
+
   let rec verify_funcs (pn,ilist)  boxes gs lems ds =
     match ds with
      [] -> (boxes, gs, lems)
@@ -3795,7 +3903,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       let FuncInfo ([], fterm, _, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, functype_opt, body, virt, overrides) = List.assoc g funcmap in
       if body = None && dialect = Some Rust && not (Filename.check_suffix g_file_name ".rsspec") then
         static_error l "A lemma function outside a .rsspec file must have a body. To assume a lemma, use the body '{ assume(false); }'." None;
-      if auto && (Filename.check_suffix g_file_name ".c" || is_import_spec || is_rust || language = CLang && Filename.chop_extension (Filename.basename g_file_name) <> Filename.chop_extension (Filename.basename program_path)) then begin
+      if auto && (Filename.check_suffix g_file_name ".c" || is_import_spec || is_rust || language = CLang && Filename.chop_extension (Filename.basename g_file_name) <> Filename.chop_extension (Filename.basename !current_program_path)) then begin
         register_prototype_used l g (Some fterm);
         create_auto_lemma l (pn,ilist) g trigger pre post ps pre_tenv tparams'
       end;
@@ -3816,9 +3924,25 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           gs
       in
       verify_funcs (pn,ilist) boxes gs lems ds
-    | Func (l, k, _, _, g, _, _, functype_opt, _, _, Some _, is_virtual, _)::ds when k <> Fixpoint ->
+    | (Func (l, k, _, _, g, _, _, functype_opt, _, _, Some _, is_virtual, _) as d)::ds when k <> Fixpoint ->
       let g = full_name pn g in
+      let cache_key =
+        match verification_cache with
+          None -> None
+        | Some cache -> Some (cache, Verification_cache.key cache d (gs @ lems))
+      in
+      let shouldFailLocs0 = !shouldFailLocs in
       let gs', lems' =
+      match cache_key with
+        Some (cache, key) when Verification_cache.mem cache key ->
+        let FuncInfo (_, _, _, _, _, _, _, _, _, _, _, _, _, Some (Some (ss, _)), _, _) = List.assoc g funcmap in
+        !stats#functionCached;
+        ss |> List.iter (stmt_iter (fun s -> if not (is_transparent_stmt s) then begin let l = stmt_loc s in !stats#stmtExec l; reportStmtExec l end));
+        Verification_cache.add cache key;
+        if is_lemma k then (gs, g::lems) else (g::gs, lems)
+      | _ ->
+      match
+      with_function_budget l g begin fun () ->
       record_fun_timing l g begin fun () ->
       let FuncInfo ([], fterm, l, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, (_, (prototype_opt, prototypeImplementationProof_opt)), Some (Some (ss, closeBraceLoc)), is_virtual, overrides) = List.assoc g funcmap in
       begin match prototype_opt, prototypeImplementationProof_opt with
@@ -3892,7 +4016,18 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       let tparams = [] in
       let env = [] in
       verify_func pn ilist gs lems boxes predinstmap funcmap tparams env l k tparams' rt g ps nonghost_callers_only pre pre_tenv post terminates ss closeBraceLoc
-      end in
+      end
+      end
+      with
+        Some result ->
+        (* A function that consumed a should-fail directive must be verified again on every run, so that the
+           directive is consumed again. *)
+        if !shouldFailLocs == shouldFailLocs0 then
+          begin match cache_key with Some (cache, key) -> Verification_cache.add cache key | None -> () end;
+        result
+      | None ->
+        if is_lemma k then (gs, g::lems) else (g::gs, lems)
+      in
       verify_funcs (pn, ilist) boxes gs' lems' ds
     | BoxClassDecl (l, bcn, _, _, _, _)::ds -> let bcn=full_name pn bcn in
       let (Some (l, boxpmap, boxinv, boxvarmap, amap, hpmap)) = try_assoc' Ghost (pn,ilist) bcn boxmap in
@@ -4031,6 +4166,8 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     | [] -> verify_classes boxes lems classmap
   
   let () = verify_funcs' [] gs0 lems0 ps
+
+  let () = match verification_cache with Some cache -> Verification_cache.save cache | None -> ()
   
   let result = 
     (
@@ -4071,6 +4208,13 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   (* Region: top-level stuff *)
   
+  (** Verifies the program at [!current_program_path]. *)
+  module VerifyCurrentProgram() = struct
+  
+  let path = !current_program_path
+  let programDir = Filename.dirname path
+  let current_module_name = current_module_name ()
+  
   let jardeps = ref []
   let provide_files = ref []
   let (prototypes_implemented, functypes_implemented, structures_defined, unions_defined,
@@ -4184,6 +4328,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     end
   
   let () = !stats#appendProverStats ctxt#stats
+  let () = !stats#appendProverCounters ctxt#counters
 
   let create_jardeps_file() =
     let jardeps_filename = Filename.chop_extension path ^ ".jardeps" in
@@ -4318,16 +4463,36 @@ There are 7 kinds of entries possible in a vfmanifest/dll_vfmanifest file
       if Filename.check_suffix path ".jarsrc" then
         create_jardeps_file()
   
+  end (* VerifyCurrentProgram *)
+  
+  let () =
+    match prelude_hook with
+      None -> let module VCP = VerifyCurrentProgram() in ()
+    | Some hook ->
+      (* Checking an empty header has the same effect as including one: it checks the prelude and caches the result in
+         [prelude_maps], so that the programs verified by the hook's verifier need not check it again. *)
+      ignore (check_file path true true programDir [] [PackageDecl (dummy_loc, "", [], [])] None);
+      hook begin fun path callbacks emitter_callback ->
+        current_program_path := path;
+        current_callbacks := callbacks;
+        current_emitter_callback := emitter_callback;
+        let module VCP = VerifyCurrentProgram() in ()
+      end
+  
 end
 
 (** Verifies the .c/.jarsrc/.scala file at path [path].
     Uses the SMT solver [ctxt].
     Reports syntax highlighting regions using the callback [reportRange] in [callbacks].
     Stops at source line [breakpoint], if not None.
+    If [prelude_hook] is given, only checks the prelude and then calls [prelude_hook]
+    with a verifier that verifies programs in the resulting prover context.
     This function is generic in the types of SMT solver types, symbols, and terms.
     *)
 let verify_program_core (* ?verify_program_core *)
     ?(emitter_callback : string -> string -> package list -> unit = fun _ _ _ -> ())
+    ?(prelude_hook : (program_verifier -> unit) option)
+    ?(prover_state_generation : unit -> int = let counter = ref 0 in fun () -> incr counter; !counter)
     (type typenode') (type symbol') (type termnode')  (* Explicit type parameters; new in OCaml 3.12 *)
     (ctxt: (typenode', symbol', termnode') Proverapi.context)
     (options : options)
@@ -4343,12 +4508,14 @@ let verify_program_core (* ?verify_program_core *)
     type symbol = symbol'
     type termnode = termnode'
     let ctxt = ctxt
+    let prover_state_generation = prover_state_generation
     let options = options
     let program_path = program_path
     let callbacks = callbacks
     let breakpoint = breakpoint
     let focus = focus
     let targetPath = targetPath
+    let prelude_hook = prelude_hook
   end) in
   ()
 
@@ -4405,8 +4572,13 @@ let lookup_prover prover =
                       prover (list_provers()))
   | Some (banner, f) -> f
 
+(** See [verify_program_core]. The verifier passed to [prelude_hook] returns the
+    statistics of the program it verified, including the checking of the prelude.
+    [path] must then name a C file; it need not exist. The hook can fork a
+    process per program, so that each process starts with the prelude checked. *)
 let verify_program (* ?verify_program *)
     ?(emitter_callback : string -> string -> package list -> unit = fun _ _ _ -> ())
+    ?(prelude_hook : ((string -> callbacks -> (string -> string -> package list -> unit) -> Stats.stats) -> unit) option)
     (prover : string)
     (options : options)
     (path : string)
@@ -4418,7 +4590,15 @@ let verify_program (* ?verify_program *)
     (object
        method run: 'typenode 'symbol 'termnode. ('typenode, 'symbol, 'termnode) Proverapi.context -> Stats.stats =
          fun ctxt -> clear_stats ();
-                     verify_program_core ~emitter_callback:emitter_callback ctxt options path callbacks breakpoint focus targetPath;
+                     let cctxt = new Proverapi.caching_context ctxt in
+                     let prover_state_generation () = cctxt#state_generation in
+                     let ctxt = (cctxt :> (_, _, _) Proverapi.context) in
+                     let prelude_hook =
+                       prelude_hook |> Option.map begin fun hook verify ->
+                         hook (fun path callbacks emitter_callback -> verify path callbacks emitter_callback; !stats)
+                       end
+                     in
+                     verify_program_core ~emitter_callback:emitter_callback ?prelude_hook ~prover_state_generation ctxt options path callbacks breakpoint focus targetPath;
                      !stats
      end)
 
@@ -4469,14 +4649,33 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
       raise (LinkError (Printf.sprintf "%d link errors" (List.length !errors)))
     end
   in
-  let consume msg x xs =
-    let rec iter xs' xs =
-      match xs with
-        [] -> link_error (msg x); xs'
-      | (x', modp')::xs -> if x = x' then xs' @ xs else iter ((x', modp')::xs') xs
-    in
-    iter [] xs
+  (* Symbol tables. The lists record the order in which the entries were added, for the DLL manifest;
+     the hash tables are used for lookups, so that linking is linear in the total size of the manifests. *)
+  let impls = ref [] in
+  let impls_table = Hashtbl.create 1000 in
+  let add_impl symbol manifest_path = impls := (symbol, manifest_path)::!impls; Hashtbl.replace impls_table symbol () in
+  let has_impl symbol = Hashtbl.mem impls_table symbol in
+  let structs = ref [] in
+  let structs_table = Hashtbl.create 1000 in
+  let preds = ref [] in
+  let preds_table = Hashtbl.create 1000 in
+  let add_definition list table (dcl_part, def as entry) = list := entry::!list; Hashtbl.replace table dcl_part def in
+  (* Modules produced and not yet imported. A module may be produced multiple times; each entry's flag is
+     cleared when it is consumed by an import. *)
+  let mods = ref [] in
+  let mods_table = Hashtbl.create 1000 in
+  let produce_module symbol manifest_path =
+    let entry = (symbol, manifest_path, ref true) in
+    mods := entry::!mods;
+    Hashtbl.add mods_table symbol entry
   in
+  let consume msg x =
+    match Hashtbl.find_opt mods_table x with
+      None -> link_error (msg x)
+    | Some (_, _, live) -> live := false; Hashtbl.remove mods_table x
+  in
+  let generated_manifests = Hashtbl.create 100 in
+  List.rev !manifest_map |> List.iter (fun (path, lines) -> Hashtbl.replace generated_manifests path lines);
   let get_lines_from_file file =
     let get_lines file =
       (file, List.filter (fun str -> str.[0] <> '#') (read_file_lines file))
@@ -4507,20 +4706,17 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
   let manifest_corruption modulepath msg =
     raise (LinkError ("Manifest file for '" ^ modulepath ^ "' is corrupted: " ^ msg))
   in
-  let rec iter (impls, structs, preds) mods modulepaths =
-    match modulepaths with
-      [] -> ((impls, structs, preds), mods)
-    | modulepath::modulepaths ->
+  allModulepaths |> List.iter begin fun modulepath ->
       let manifest_path = 
         try Filename.chop_extension modulepath ^ ".vfmanifest" with
           Invalid_argument  _ -> raise (CompilationError "file without extension")
       in
-      let is_generated_manifest = List.mem_assoc manifest_path !manifest_map in 
+      let generated_manifest = Hashtbl.find_opt generated_manifests manifest_path in
+      let is_generated_manifest = generated_manifest <> None in
       let (manifest_path, lines) =
-        if is_generated_manifest then
-          (manifest_path, List.assoc manifest_path !manifest_map)
-        else
-          get_lines_from_file manifest_path
+        match generated_manifest with
+          Some lines -> (manifest_path, lines)
+        | None -> get_lines_from_file manifest_path
       in
       let rebase_path path = rebase_path manifest_path path in
       let check_file_name path =
@@ -4544,10 +4740,7 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
         if (not (Sys.file_exists absolute_path)) then 
           manifest_corruption modulepath ("file does not exist " ^ path ^ " (absolute: " ^ absolute_path ^ ")")
       in
-      let rec iter0 (impls', structs', preds') mods' lines =
-        match lines with
-          [] -> iter (impls', structs', preds') mods' modulepaths
-        | line::lines ->
+      lines |> List.iter begin fun line ->
           let (command, symbol) = parse_line line in
           begin
             match command with
@@ -4565,12 +4758,11 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
                 let dcl_part = rebase_path dcl_part in
                 let def_file = rebase_path def_file in
                 let entry = (dcl_part, (def_file, manifest_path)) in
-                match try_assoc dcl_part structs with
+                match Hashtbl.find_opt structs_table dcl_part with
                 | Some (def_file2, _) ->
                   if def_file <> def_file2 then 
-                    link_error ("Module '" ^ modulepath ^ "': Structure " ^ dcl_part ^ " is defined twice.");
-                  iter0 (impls', structs', preds') mods' lines
-                | None -> iter0 (impls', entry::structs', preds') mods' lines
+                    link_error ("Module '" ^ modulepath ^ "': Structure " ^ dcl_part ^ " is defined twice.")
+                | None -> add_definition structs structs_table entry
               end
             | ".predicate" -> 
               begin
@@ -4586,12 +4778,11 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
                 let dcl_part = rebase_path dcl_part in
                 let def_file = rebase_path def_file in
                 let entry = (dcl_part, (def_file, manifest_path)) in
-                match try_assoc dcl_part preds with
+                match Hashtbl.find_opt preds_table dcl_part with
                 | Some (def_file2, _) ->
                   if def_file <> def_file2 then
-                    link_error ("Module '" ^ modulepath ^ "': Predicates " ^ dcl_part ^ " is given a body twice.");
-                  iter0 (impls', structs', preds') mods' lines
-                | None -> iter0 (impls', structs', entry::preds') mods' lines
+                    link_error ("Module '" ^ modulepath ^ "': Predicates " ^ dcl_part ^ " is given a body twice.")
+                | None -> add_definition preds preds_table entry
               end
             | ".provides"   ->
               begin
@@ -4603,12 +4794,9 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
                   check_file_name path;
                 end;
                 let symbol = rebase_path symbol in
-                let entry = (symbol, manifest_path) in
-                begin match try_assoc0 symbol impls' with
-                | Some _ -> link_error ("Module '" ^ modulepath ^ "': Function " ^ symbol ^ " is implemented twice.")
-                | None -> ()
-                end;
-                iter0 (entry::impls', structs', preds') mods' lines
+                if has_impl symbol then
+                  link_error ("Module '" ^ modulepath ^ "': Function " ^ symbol ^ " is implemented twice.");
+                add_impl symbol manifest_path
               end
             | ".requires"   ->
               begin
@@ -4620,70 +4808,40 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
                   check_file_name path;
                 end;
                 let symbol = rebase_path symbol in
-                begin match try_assoc0 symbol impls' with
-                | Some _ -> ()
-                | None -> link_error ("Module '" ^ modulepath ^ "': unsatisfied requirement '" ^ symbol ^ "'.")
-                end;
-                iter0 (impls', structs', preds') mods' lines
+                if not (has_impl symbol) then
+                  link_error ("Module '" ^ modulepath ^ "': unsatisfied requirement '" ^ symbol ^ "'.")
               end
             | ".produces" ->
-              iter0 (impls', structs', preds') ((symbol, manifest_path)::mods') lines
+              produce_module symbol manifest_path
             | ".imports" ->
-              let mods'' =
-                consume (fun x -> "Module '" ^ modulepath ^ "': unsatisfied import '" ^ x ^ "'.") symbol mods'
-              in
-              iter0 (impls', structs', preds') mods'' lines
+              consume (fun x -> "Module '" ^ modulepath ^ "': unsatisfied import '" ^ x ^ "'.") symbol
             | _ -> manifest_corruption modulepath ("cannot parse line " ^ line)
           end
-      in
-      iter0 (impls, structs, preds) mods lines
-  in
-  let ((impls, structs, preds), mods) = iter ([], [], []) [] allModulepaths in
-  let mods =
-    if not isLibrary then
+      end
+  end;
+  if not isLibrary then
     begin
       let main = "CRT/prelude.h#main : main()" in 
       let main_full = (Printf.sprintf "CRT/prelude.h#main : main_full(%s)" mainModuleName) in
-      begin match (try_assoc main impls, try_assoc main_full impls) with
-      | (None, None) ->
-        link_error ("Program does not implement a function 'main' that implements function type 'main' or 'main_full' declared in prelude.h. Use the '-shared' option to suppress this error.")
-      | _ -> ()
-      end;
-      consume (fun _ -> "Could not consume the main module") ("module " ^ mainModuleName) mods
-    end
-    else
-      mods
-  in
+      if not (has_impl main || has_impl main_full) then
+        link_error ("Program does not implement a function 'main' that implements function type 'main' or 'main_full' declared in prelude.h. Use the '-shared' option to suppress this error.");
+      consume (fun _ -> "Could not consume the main module") ("module " ^ mainModuleName)
+    end;
   check_errors ();
-  let (impls, mods) =
-    let rec iter (impls, mods) exports =
-      match exports with
-        [] -> (impls, mods)
-      | exportPath::exports ->
-        let lines = try read_file_lines exportPath with FileNotFound _ -> failwith ("Could not find export manifest file '" ^ exportPath ^ "'") in
-        let rec iter' (impls, mods) lines =
-          match lines with
-            [] -> (impls, mods)
-          | line::lines ->
-            let (command, symbol) = parse_line line in
-            match command with
-            | ".provides" ->
-              begin
-                let symbol = rebase_path exportPath symbol in
-                match try_assoc0 symbol impls with
-                | Some _ -> iter' (impls, mods) lines
-                | None ->  raise (LinkError (Printf.sprintf "Unsatisfied requirement '%s' in export manifest '%s'" symbol exportPath))
-              end
-            | ".produces" ->
-              let mods = consume (fun s -> Printf.sprintf "Unsatisfied requirement '%s' in export manifest '%s'" s exportPath) symbol mods in
-              iter' (impls, mods) lines
-            | _ -> raise (LinkError ("Incorrect export manifest " ^ exportPath))
-        in
-        let (impls, mods) = iter' (impls, mods) lines in
-        iter (impls, mods) exports
-    in
-    iter (impls, mods) exports
-  in
+  exports |> List.iter begin fun exportPath ->
+    let lines = try read_file_lines exportPath with FileNotFound _ -> failwith ("Could not find export manifest file '" ^ exportPath ^ "'") in
+    lines |> List.iter begin fun line ->
+      let (command, symbol) = parse_line line in
+      match command with
+      | ".provides" ->
+        let symbol = rebase_path exportPath symbol in
+        if not (has_impl symbol) then
+          raise (LinkError (Printf.sprintf "Unsatisfied requirement '%s' in export manifest '%s'" symbol exportPath))
+      | ".produces" ->
+        consume (fun s -> Printf.sprintf "Unsatisfied requirement '%s' in export manifest '%s'" s exportPath) symbol
+      | _ -> raise (LinkError ("Incorrect export manifest " ^ exportPath))
+    end
+  end;
   match dllManifest with None -> () | Some(_) ->
   begin
     try
@@ -4707,10 +4865,10 @@ let link_program vroots library_paths isLibrary allModulepaths dllManifest expor
         else
           Printf.fprintf manifestFile ".produces %s\n" m
       in
-      impls   |> List.iter print_requires_or_provides;
-      structs |> List.iter (print_if_necesarry ".structure");
-      preds   |> List.iter (print_if_necesarry ".predicate");
-      mods    |> List.iter print_module;
+      !impls   |> List.iter print_requires_or_provides;
+      !structs |> List.iter (print_if_necesarry ".structure");
+      !preds   |> List.iter (print_if_necesarry ".predicate");
+      !mods    |> List.iter (fun (m, modp, live) -> if !live then print_module (m, modp));
       close_out manifestFile
     with
       Sys_error s -> raise (LinkError (Printf.sprintf "Could not create DLL manifest file '%s': %s" mainModuleManifest s))
@@ -38,24 +38,36 @@ type callbacks = {
 
 let noop_callbacks = {reportRange = (fun _ _ -> ()); reportUseSite = (fun _ _ _ -> ()); reportExecutionForest = (fun _ -> ()); reportStmt = (fun _ -> ()); reportStmtExec = (fun _ -> ()); reportDirective = (fun _ _ -> false)}
 
+(** [verifier path callbacks emitter_callback] verifies the program at [path],
+    in a prover context in which the prelude has already been checked. *)
+type program_verifier = string -> callbacks -> (string -> string -> package list -> unit) -> unit
+
 module type VERIFY_PROGRAM_ARGS = sig
   val emitter_callback: string -> string -> package list -> unit
   type typenode
   type symbol
   type termnode
   val ctxt: (typenode, symbol, termnode) Proverapi.context
+  val prover_state_generation: unit -> int (* Identifies the set of assumptions of [ctxt]; see Proverapi.caching_context#state_generation *)
   val options: options
   val program_path: string
   val callbacks: callbacks
   val breakpoint: (string * int) option
   val focus: (string * int) option (* Only verify the function/method/ctor on the specified source line *)
   val targetPath: int list option
+  val prelude_hook: (program_verifier -> unit) option (* If present, only the prelude is checked and the hook is called with a verifier for programs with the same language and options *)
 end
 
 module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
 
   include VerifyProgramArgs
 
+  (* A [prelude_hook]'s verifier replaces the program path and callbacks before verifying the program. *)
+  let current_program_path = ref program_path
+  let current_callbacks = ref callbacks
+  let current_emitter_callback = ref emitter_callback
+  let emitter_callback path dir ps = !current_emitter_callback path dir ps
+
   let () = Hashtbl.clear typedefs
 
   let path = program_path
@@ -123,7 +135,12 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
 
   let assume_left_to_right_evaluation = assume_left_to_right_evaluation || language <> CLang || dialect = Some Rust
 
-  let {reportRange; reportUseSite; reportExecutionForest; reportStmt; reportStmtExec; reportDirective} = callbacks
+  let reportRange kind l = (!current_callbacks).reportRange kind l
+  let reportUseSite dk ld lu = (!current_callbacks).reportUseSite dk ld lu
+  let reportExecutionForest forest = (!current_callbacks).reportExecutionForest forest
+  let reportStmt l = (!current_callbacks).reportStmt l
+  let reportStmtExec l = (!current_callbacks).reportStmtExec l
+  let reportDirective directive l = (!current_callbacks).reportDirective directive l
 
   let item_path_separator = if language = Java then "." else "::"
 
@@ -224,8 +241,62 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let pop_undoStack () = List.iter (fun f -> f ()) !undoStack; let h::t = !undoStackStack in undoStack := h; undoStackStack := t
   
   let executionForest: node list ref = ref [] (* toplevel list of execution trees *)
-  let () = reportExecutionForest executionForest
-  let currentForest: node list ref ref = ref executionForest
+  let () = match !exec_tree_mode with BuildExecTree -> reportExecutionForest executionForest | _ -> ()
+  let execTraceWriter = match !exec_tree_mode with StreamExecTree w -> Some w | _ -> None
+  let execTreeEnabled = match !exec_tree_mode with NoExecTree -> false | _ -> true
+
+  (** A node of the execution forest whose children are being generated. In
+      StreamExecTree mode, the children are written to the trace file instead
+      of being stored in [children]. *)
+  type forest_cursor = {children: node list ref; nodeId: int; mutable childCount: int}
+
+  let currentForest: forest_cursor ref = ref {children = executionForest; nodeId = 0; childCount = 0}
+
+  (** Adds a node to the execution forest under [cursor] and returns a cursor for its children. *)
+  let add_forest_node cursor nodeType =
+    if not execTreeEnabled then cursor else begin
+      cursor.childCount <- cursor.childCount + 1;
+      match execTraceWriter with
+        None ->
+        let children = ref [] in
+        cursor.children := Node (nodeType, children)::!(cursor.children);
+        {children; nodeId = 0; childCount = 0}
+      | Some w ->
+        {children = cursor.children; nodeId = Exec_trace.write_node w cursor.nodeId nodeType; childCount = 0}
+    end
+
+  exception FunctionBudgetExceeded of string (* The budget that was exceeded *)
+
+  let budgets_enabled = options.option_max_steps_per_function <> None || options.option_max_prover_seconds_per_function <> None
+
+  (** The number of execution steps left in the budget of the function being verified, and the reading of Redux.stopwatch at which
+      its prover time budget runs out. Set by with_function_budget. *)
+  let function_steps_left = ref max_int
+  let function_prover_deadline = ref Int64.max_int
+
+  (** The number of execution steps spent on each source line (path, line) by the function being verified, to report
+      its hottest lines if it exceeds its budget. *)
+  let function_line_steps: (string * int, int ref) Hashtbl.t = Hashtbl.create 100
+
+  (** Charges an execution step with context [msg] to the budget of the function being verified. *)
+  let charge_function_budget msg =
+    begin match msg with
+      Executing (_, _, l, _) ->
+      let ((path, line, _), _) = root_caller_token l in
+      begin match Hashtbl.find_opt function_line_steps (path, line) with
+        Some count -> incr count
+      | None -> Hashtbl.add function_line_steps (path, line) (ref 1)
+      end
+    | _ -> ()
+    end;
+    decr function_steps_left;
+    let budget_exceeded budget =
+      ignore (add_forest_node !currentForest ErrorNode);
+      raise (FunctionBudgetExceeded budget)
+    in
+    if !function_steps_left < 0 then budget_exceeded "execution step budget";
+    if !function_steps_left land 255 = 0 && Stopwatch.ticks Redux.stopwatch > !function_prover_deadline then budget_exceeded "prover time budget"
+
   let currentPath: int list ref = ref []
   let currentBranch: int ref = ref 0
   let targetPath: int list option ref = ref (match targetPath with None -> None | Some bs -> Some (List.rev bs))
@@ -333,7 +404,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let success () = SymExecSuccess
 
   let major_success () =  (* A major success is a successful completion of a symbolic execution path that shows up as a green node in the execution tree. *)
-    push (Node (SuccessNode, ref [])) !currentForest;
+    ignore (add_forest_node !currentForest SuccessNode);
     success ()
 
   let pop_context () = let (h::t) = !contextStack in contextStack := t
@@ -343,10 +414,14 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let push_contextStack () = push_undoStack(); contextStackStack := !contextStack::!contextStackStack
   let pop_contextStack () = pop_undoStack(); let h::t = !contextStackStack in contextStack := h; contextStackStack := t
 
+  (** The number of prover scopes opened by push and assume that have not yet been closed. *)
+  let prover_push_depth = ref 0
+
   (** Remember the current path condition, set of used IDs, and set of dummy fraction terms. *)  
   let push() =
     used_ids_stack := (!used_ids_undo_stack, !dummy_frac_terms, !pred_ctor_applications)::!used_ids_stack;
     used_ids_undo_stack := [];
+    incr prover_push_depth;
     ctxt#push;
     push_contextStack ()
   
@@ -359,6 +434,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     dummy_frac_terms := dummyFracTerms;
     pred_ctor_applications := predCtorApplications;
     used_ids_stack := t;
+    decr prover_push_depth;
     ctxt#pop
   
   (** Execute [cont] in a temporary context. *)
@@ -736,12 +812,12 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   let real_unit_pat = TermPat real_unit
   
-  let current_module_name =
+  let current_module_name () =
     match language with
       | Java -> "current_module"
-      | CLang -> Filename.chop_extension (Filename.basename path)
+      | CLang -> Filename.chop_extension (Filename.basename !current_program_path)
   
-  let current_module_term = get_unique_var_symb current_module_name intType
+  let current_module_term = get_unique_var_symb (current_module_name ()) intType
   
   let programDir = Filename.dirname path
   let rtpath = match Vfbindings.get Vfparam_runtime vfbindings with None -> concat (rtdir()) "rt.jarspec" | Some path -> path
@@ -1206,31 +1282,34 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let () = emitter_callback filepath dir ps
 
   let assert_false h env l msg url =
-    Util.push (Node (ErrorNode, ref [])) !currentForest;
+    ignore (add_forest_node !currentForest ErrorNode);
     raise (SymbolicExecutionError (pprint_context_stack !contextStack dbg_info, l, msg, Option.map (fun topic -> [HelpTopic topic]) url))
 
   let push_node l msg =
-    let oldPath, oldBranch, oldTargetPath = !currentPath, !currentBranch, !targetPath in
-    targetPath :=
-      begin match oldTargetPath with
-        Some (b::bs) ->
-          if b = oldBranch then
-            if bs = [] then
-              assert_false [] [] l "Target branch reached" None
+    (* The path of the current node is needed only to label the nodes of the execution tree and to find the target node. *)
+    if execTreeEnabled || !targetPath <> None then begin
+      let oldPath, oldBranch, oldTargetPath = !currentPath, !currentBranch, !targetPath in
+      targetPath :=
+        begin match oldTargetPath with
+          Some (b::bs) ->
+            if b = oldBranch then
+              if bs = [] then
+                assert_false [] [] l "Target branch reached" None
+              else
+                Some bs
             else
-              Some bs
-          else
-            Some []
-        | p -> p
-      end;
-    currentPath := oldBranch::oldPath;
-    currentBranch := 0;
-    push_undo_item (fun () -> currentPath := oldPath; currentBranch := oldBranch + 1; targetPath := oldTargetPath);
-    let newForest = ref [] in
-    let oldForest = !currentForest in
-    Util.push (Node (ExecNode (msg, !currentPath), newForest)) oldForest;
-    push_undo_item (fun () -> currentForest := oldForest);
-    currentForest := newForest
+              Some []
+          | p -> p
+        end;
+      currentPath := oldBranch::oldPath;
+      currentBranch := 0;
+      push_undo_item (fun () -> currentPath := oldPath; currentBranch := oldBranch + 1; targetPath := oldTargetPath);
+      if execTreeEnabled then begin
+        let oldForest = !currentForest in
+        currentForest := add_forest_node oldForest (ExecNode (msg, !currentPath));
+        push_undo_item (fun () -> currentForest := oldForest)
+      end
+    end
 
   let push_context ?(verbosity_level = 1) msg =
     contextStack := msg::!contextStack;
@@ -1241,26 +1320,53 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       | _ -> ()
     end
 
+  (** The stack to which the profiler attributes the current execution step: the message of the outermost
+      context frame, followed by the line of the innermost Executing frame at each subcontext level. Steps
+      outside any Executing frame are attributed to a root frame named "(no context)". *)
+  let profile_stack ctxts =
+    let frame_of_loc l = let ((path, line, _), _) = root_caller_token l in Filename.basename path ^ ":" ^ string_of_int line in
+    let rec iter root frames lo ctxts =
+      match ctxts with
+        [] -> root, (match lo with None -> frames | Some l -> l::frames)
+      | Executing (_, _, l, msg)::ctxts -> iter (if root = None then Some msg else root) frames (Some l) ctxts
+      | PushSubcontext::ctxts -> iter root (match lo with None -> frames | Some l -> l::frames) None ctxts
+      | PopSubcontext::ctxts -> begin match frames with [] -> iter root [] None ctxts | l::frames -> iter root frames (Some l) ctxts end
+      | _::ctxts -> iter root frames lo ctxts
+    in
+    let root, frames = iter None [] None (List.rev ctxts) in
+    String.concat ";" (Option.value root ~default:"(no context)"::List.rev_map frame_of_loc frames)
+
+  (* Unlike push_contextStack and pop_contextStack, with_context saves the context stack and the undo stack in
+     local variables; it is called for every execution step, and this avoids allocating stack cells and closures. *)
+  let restore_context oldContextStack oldUndoStack =
+    List.iter (fun f -> f ()) !undoStack;
+    undoStack := oldUndoStack;
+    contextStack := oldContextStack;
+    if !Profiler.enabled then Profiler.switch_to (profile_stack oldContextStack)
+
   let with_context_force msg cont =
     !stats#execStep;
-    push_contextStack ();
+    if budgets_enabled then charge_function_budget msg;
+    let oldContextStack = !contextStack in
+    let oldUndoStack = !undoStack in
+    undoStack := [];
     push_context msg;
-    let result = cont() in
-    pop_contextStack ();
-    result
+    if !Profiler.enabled then Profiler.switch_to (profile_stack !contextStack);
+    match cont () with
+      result -> restore_context oldContextStack oldUndoStack; result
+    | exception e -> restore_context oldContextStack oldUndoStack; raise e
 
   let with_context ?(verbosity_level = 1) msg cont =
     !stats#execStep;
-    push_contextStack ();
+    if budgets_enabled then charge_function_budget msg;
+    let oldContextStack = !contextStack in
+    let oldUndoStack = !undoStack in
+    undoStack := [];
     push_context ~verbosity_level msg;
-    do_finally
-      begin fun () ->
-        if !targetPath <> Some [] then
-          cont ()
-        else
-          SymExecSuccess
-      end
-      pop_contextStack
+    if !Profiler.enabled then Profiler.switch_to (profile_stack !contextStack);
+    match if !targetPath <> Some [] then cont () else SymExecSuccess with
+      result -> restore_context oldContextStack oldUndoStack; result
+    | exception e -> restore_context oldContextStack oldUndoStack; raise e
 
   let is_jarspec = Filename.check_suffix filepath ".jarspec"
 
@@ -1389,7 +1495,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
             let (headers', maps) =
               match try_assoc path !headermap with
                 None ->
-                let header_is_import_spec = Filename.remove_extension (Filename.basename header_path) <> Filename.chop_extension (Filename.basename program_path) in
+                let header_is_import_spec = Filename.remove_extension (Filename.basename header_path) <> Filename.chop_extension (Filename.basename !current_program_path) in
                 let (headers', ds) =
                   match language with
                     CLang ->
@@ -1420,7 +1526,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                     (jarspecs, ds)
                 in
                 reportUseSite DeclKind_HeaderFile (Lexed ((path, 1, 1), (path, 1, 1))) l;
-                let (_, maps) = check_file header_path header_is_import_spec include_prelude (Filename.dirname path) headers' ds (*Todo @Nima: dbg_info*) None in
+                let (_, maps) = !stats#timeHeaderCheck (fun () -> check_file header_path header_is_import_spec include_prelude (Filename.dirname path) headers' ds (*Todo @Nima: dbg_info*) None) in
                 headermap := (path, (headers', maps))::!headermap;
                 (headers', maps)
               | Some (headers', maps) ->
@@ -1449,7 +1555,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                 let rtdir = Filename.dirname rtpath in
                 let ds = Java_frontend_bridge.parse_java_files (List.map (fun x -> concat rtdir x) javaspecs) [] reportRange
                                                                reportShouldFail initial_verbosity enforce_annotations use_java_frontend in
-                let (_, maps0) = check_file rtpath true false !bindir [] ds (*Todo @Nima: dbg_info*) None in
+                let (_, maps0) = !stats#timeHeaderCheck (fun () -> check_file rtpath true false !bindir [] ds (*Todo @Nima: dbg_info*) None) in
                 headermap := (rtpath, ([], maps0))::!headermap;
                 (maps0, [])
               | Some ([], maps0) ->
@@ -1489,7 +1595,14 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                   | _ -> "prelude.h", parse_header_file 
                 in
                 let prelude_path = concat !bindir prelude_name in
-                let (prelude_headers, prelude_decls) = parse_header_file reportMacroCall prelude_path reportRange reportShouldFail initial_verbosity [] [] enforce_annotations data_model in
+                let (prelude_headers, prelude_decls) =
+                  let parse (reportMacroCall, reportRange, reportShouldFail) = parse_header_file reportMacroCall prelude_path reportRange reportShouldFail initial_verbosity [] [] enforce_annotations data_model in
+                  let callbacks = (reportMacroCall, reportRange, reportShouldFail) in
+                  if dialect = None then
+                    Header_cache.parse_header_file_cached prelude_path [string_of_bool enforce_annotations; Digest.to_hex (Digest.string (Marshal.to_string data_model []))] callbacks parse
+                  else
+                    parse callbacks
+                in
                 let prelude_header_names = List.map (fun (_, (_, _, h), _, _) -> h) prelude_headers in
                 let prelude_headers = (dummy_loc, (AngleBracketInclude, prelude_name, prelude_path), prelude_header_names, prelude_decls)::prelude_headers in
                 merge_header_maps false maps0 [] !bindir prelude_headers prelude_headers
@@ -2555,7 +2668,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
 
   (* Region: modulemap *)
 
-  let modulemap1 = [(current_module_name, current_module_term)]
+  let modulemap1 = [(current_module_name (), current_module_term)]
 
   let modulemap1 = 
     let rec iter mm ds = 
@@ -7980,6 +8093,7 @@ let check_if_list_is_defined () =
   let assume t cont =
     !stats#proverAssume;
     push_context (Assuming t);
+    incr prover_push_depth;
     ctxt#push;
     let result =
       match ctxt#assume t with
@@ -7987,6 +8101,7 @@ let check_if_list_is_defined () =
       | Unsat -> major_success ()
     in
     pop_context();
+    decr prover_push_depth;
     ctxt#pop;
     result
   
@@ -0,0 +1,25 @@
+module R = Redux
+module Sp = Smtlibprover
+module C = Combineprovers
+module P = Proverapi
+
+(* The number of seconds Z3 is given for each query. *)
+let query_timeout = 10.0
+
+let register_plugin () =
+  Verifast.register_prover "Redux+ext_z3_race"
+    "(experimental) run Redux and an external Z3 process on each query at the same time; a query succeeds as soon as either proves it."
+    (
+      fun client ->
+      let redux_ctxt =
+        (new R.context ():
+           R.context :> (unit, R.symbol, (R.symbol, R.termnode) R.term) P.context)
+      in
+      let z3_ctxt, start_z3_query =
+        Sp.racing_smtlib_ctxt
+          "z3 -in -smt2 smt.auto_config=false smt.mbqi=false auto_config=false model=false type_check=true well_sorted_check=true"
+          ["z3"; "I"; "Q"; "NDT"; "LIA"; "LRA"]
+          query_timeout
+      in
+      client#run (C.combine ~start_query2:start_z3_query redux_ctxt z3_ctxt (C.Race query_timeout))
+    )
@@ -5,4 +5,11 @@ let register_plugin () =
       fun client ->
         let ctxt = (new Z3v4dot5prover.z3_context() : Z3v4dot5prover.z3_context :> (Z3native.sort, Z3native.func_decl, Z3native.ast) Proverapi.context) in
         client#run ctxt
+    );
+  Verifast.register_prover "Z3v4.5+assumptions"
+    "the Z3 SMT solver, using assumption literals instead of push and pop, so that the solver's work is preserved across queries."
+    (
+      fun client ->
+        let ctxt = (new Z3v4dot5prover.z3_context ~use_assumptions:true () : Z3v4dot5prover.z3_context :> (Z3native.sort, Z3native.func_decl, Z3native.ast) Proverapi.context) in
+        client#run ctxt
     )
@@ -0,0 +1,196 @@
+open Ast
+open Ocaml_expr
+
+(*
+
+Per-function verification result cache (command-line option -incremental).
+
+For each function that verifies successfully, we record a key in a .vfcache
+file next to the source file. The key is a digest of:
+- the context: the VeriFast executable, the verification options, and the
+  contents of all header files (including the prelude) that were loaded;
+- the function's declaration, i.e. its signature, contract and body;
+- the declarations of the current file that the function transitively depends
+  on (predicates, fixpoints, lemmas, structs, called functions' contracts, ...);
+- the subset of those declarations that precede the function in the file and
+  that it may therefore call without a termination check.
+
+Declarations are fingerprinted without source locations, so that edits
+elsewhere in the file do not invalidate unrelated functions. Dependencies are
+approximated conservatively: a declaration depends on every declaration of
+the file that defines a name it mentions. Declarations that define no name
+(e.g. type predicate definitions) and auto lemmas, which are applied without
+being mentioned, are assumed to be depended on by every function.
+
+On a subsequent run, a function whose key is present in the cache is not
+verified again. Functions whose verification consumed a should-fail directive
+are never cached, so that the directive is consumed again on each run. The
+cache is not used when emitting or checking manifests, since these depend on
+side effects of verifying each function, nor when only part of the program is
+verified (-focus, -breakpoint, -break_at_node).
+
+*)
+
+let cache_format_version = "VeriFast-vfcache 1"
+
+let cache_path_of_source_path path = Filename.remove_extension path ^ ".vfcache"
+
+(** The names that are defined by a top-level declaration. *)
+let defined_names d =
+  match d with
+    Inductive (_, i, _, ctors) -> i::List.map (fun (Ctor (_, c, _)) -> c) ctors
+  | EnumDecl (_, en, elems) -> en::List.map fst elems
+  | Union (_, un, _) -> [un]
+  | Class (_, _, _, cn, _, _, _, _, _, _, _) -> [cn]
+  | Interface (_, itf, _, _, _, _, _) -> [itf]
+  | BoxClassDecl (_, bcn, _, _, _, _) -> [bcn]
+  | Global (_, _, x, _) -> [x]
+  | CxxCtor (_, mangled_name, _, _, _, _, _, _) -> [mangled_name]
+  | CxxDtor (_, mangled_name, _, _, _, _, _, _, _) -> [mangled_name]
+  | TypePredDecl (_, _, _, predName) -> [predName]
+  | d ->
+    match Ast_aux.decl_loc_name_and_name_setter d with
+      Some (_, x, _) -> [x]
+    | None -> []
+
+type decl_info = {fingerprint: string; mentions: string list}
+
+(** Whether [d] may be used by a function that does not mention it. *)
+let is_applied_implicitly d =
+  match d with
+    Func (_, Lemma (true, _), _, _, _, _, _, _, _, _, _, _, _) -> true
+  | _ -> false
+
+(** Computes a location-independent fingerprint of [d], as well as the list of
+    identifiers mentioned by [d]. Information computed by the type checker and
+    stored in mutable fields of the AST is ignored. *)
+let decl_info_of d =
+  let buf = Buffer.create 1024 in
+  let mentions = ref [] in
+  let rec iter e =
+    match e with
+      C ("InferredType", _) -> Buffer.add_string buf "InferredType"
+    | C (ctor, args) -> Buffer.add_string buf ctor; iters '(' ')' args
+    | S s -> mentions := s::!mentions; Printf.bprintf buf "%S" s
+    | I i -> Printf.bprintf buf "%d" i
+    | B b -> Printf.bprintf buf "%B" b
+    | BigInt n -> Buffer.add_string buf (Big_int.string_of_big_int n)
+    | Num n -> Buffer.add_string buf (Num.string_of_num n)
+    | L es -> iters '[' ']' es
+    | T es -> iters '(' ')' es
+    | Ref _ -> Buffer.add_string buf "ref"
+    | Call (f, args) -> Buffer.add_string buf f; iters '(' ')' args
+    | Loc _ -> Buffer.add_char buf 'l'
+  and iters opening closing es =
+    Buffer.add_char buf opening;
+    List.iter (fun e -> iter e; Buffer.add_char buf ',') es;
+    Buffer.add_char buf closing
+  in
+  iter (Ocaml_expr_of_ast.of_decl d);
+  {fingerprint = Digest.string (Buffer.contents buf); mentions = !mentions}
+
+type t = {
+  path: string; (* Path of the .vfcache file *)
+  context: string; (* Digest of the executable, the options, and the headers *)
+  decls: (string, decl_info) Hashtbl.t; (* Maps each name to the declarations that define it *)
+  anonymous_decls: string; (* Digest of the declarations that define no name or that are applied implicitly *)
+  cached_keys: (string, unit) Hashtbl.t; (* Keys read from the .vfcache file *)
+  mutable keys: string list; (* Keys verified or reused in this run *)
+}
+
+let digest_of_file path = try Digest.to_hex (Digest.file path) with Sys_error _ -> ""
+
+let read_cached_keys path =
+  let keys = Hashtbl.create 100 in
+  if Sys.file_exists path then begin
+    let chan = open_in path in
+    begin try
+      if input_line chan = cache_format_version then
+        while true do
+          Hashtbl.replace keys (input_line chan) ()
+        done
+    with End_of_file -> ()
+    end;
+    close_in chan
+  end;
+  keys
+
+(** [create source_path options_digest header_paths packages] loads the cache for
+    [source_path]. [options_digest] identifies the verification options and
+    [header_paths] lists all header files loaded while checking the file. *)
+let create source_path options_digest header_paths packages =
+  let header_digests =
+    List.sort_uniq compare header_paths |> List.map (fun path -> path ^ "=" ^ digest_of_file path)
+  in
+  let context =
+    Digest.string (String.concat "\n" (cache_format_version::digest_of_file Sys.executable_name::options_digest::header_digests))
+  in
+  let decls = Hashtbl.create 1000 in
+  let anonymous_decls = ref [] in
+  packages |> List.iter begin fun (PackageDecl (_, _, _, ds)) ->
+    ds |> List.iter begin fun d ->
+      let info = decl_info_of d in
+      let names = defined_names d in
+      if names = [] || is_applied_implicitly d then anonymous_decls := info.fingerprint::!anonymous_decls;
+      names |> List.iter (fun x -> Hashtbl.add decls x info)
+    end
+  end;
+  let path = cache_path_of_source_path source_path in
+  {
+    path;
+    context;
+    decls;
+    anonymous_decls = Digest.string (String.concat "" (List.rev !anonymous_decls));
+    cached_keys = read_cached_keys path;
+    keys = []
+  }
+
+(** The cache key for declaration [d]. [preceding] lists the (possibly
+    package-qualified) names of the functions and lemmas that precede [d]. *)
+let key cache d preceding =
+  let visited_names = Hashtbl.create 100 in
+  let visited_decls = Hashtbl.create 100 in
+  let rec visit names =
+    match names with
+      [] -> ()
+    | x::names when Hashtbl.mem visited_names x -> visit names
+    | x::names ->
+      Hashtbl.add visited_names x ();
+      let infos = Hashtbl.find_all cache.decls x in
+      infos |> List.iter (fun info -> Hashtbl.replace visited_decls info.fingerprint ());
+      visit (List.fold_left (fun names info -> List.rev_append info.mentions names) names infos)
+  in
+  let info = decl_info_of d in
+  visit info.mentions;
+  let deps = Hashtbl.fold (fun fingerprint () fps -> fingerprint::fps) visited_decls [] |> List.sort compare in
+  let unqualified x = match String.rindex_opt x '.' with None -> x | Some i -> String.sub x (i + 1) (String.length x - i - 1) in
+  let preceding = preceding |> List.filter (fun x -> Hashtbl.mem visited_names x || Hashtbl.mem visited_names (unqualified x)) |> List.sort compare in
+  Digest.to_hex (Digest.string (String.concat "\n" (cache.context::cache.anonymous_decls::info.fingerprint::deps @ "#preceding"::preceding)))
+
+let mem cache key = Hashtbl.mem cache.cached_keys key
+
+let write_keys path keys =
+  let chan = open_out path in
+  output_string chan (cache_format_version ^ "\n");
+  List.iter (fun key -> output_string chan (key ^ "\n")) keys;
+  close_out chan
+
+(** Records that the function with key [key] verified successfully (or was reused).
+    The key is written to the cache file immediately, so that it survives a
+    verification failure later in the file. *)
+let add cache key =
+  cache.keys <- key::cache.keys;
+  if not (Hashtbl.mem cache.cached_keys key) then begin
+    Hashtbl.replace cache.cached_keys key ();
+    if Hashtbl.length cache.cached_keys = 1 then
+      write_keys cache.path [key]
+    else begin
+      let chan = open_out_gen [Open_wronly; Open_append; Open_creat; Open_text] 0o666 cache.path in
+      output_string chan (key ^ "\n");
+      close_out chan
+    end
+  end
+
+(** Rewrites the cache file so that it contains only the keys used in this run. *)
+let save cache =
+  write_keys cache.path (List.rev cache.keys)
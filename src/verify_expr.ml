@@ -365,7 +365,7 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     end;
     let functype_opt =
       match functype_opt with
-        None when body <> None && fn = "main" -> Some ("main_full", [], [(l, current_module_name)])
+        None when body <> None && fn = "main" -> Some ("main_full", [], [(l, current_module_name ())])
       | _ -> functype_opt
     in
     let functype_opt =
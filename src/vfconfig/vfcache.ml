@@ -0,0 +1,57 @@
+(* Location of VeriFast's on-disk caches (parsed headers, Rust toolchain paths, ...).
+
+   The caches are stored in $VERIFAST_CACHE_DIR, or in the verifast subdirectory of
+   the user's cache directory. Setting VERIFAST_CACHE_DIR to the empty string
+   disables the on-disk caches. *)
+
+let cache_dir =
+  lazy begin
+    match Sys.getenv_opt "VERIFAST_CACHE_DIR" with
+      Some "" -> None
+    | Some dir -> Some dir
+    | None ->
+      let (var, subdir) =
+        match Vfconfig.platform with
+          Vfconfig.Windows -> ("LOCALAPPDATA", "VeriFast")
+        | Vfconfig.MacOS -> ("HOME", Filename.concat "Library" (Filename.concat "Caches" "VeriFast"))
+        | Vfconfig.Linux ->
+          match Sys.getenv_opt "XDG_CACHE_HOME" with
+            Some dir when dir <> "" -> ("XDG_CACHE_HOME", "verifast")
+          | _ -> ("HOME", Filename.concat ".cache" "verifast")
+      in
+      Option.map (fun dir -> Filename.concat dir subdir) (Sys.getenv_opt var)
+  end
+
+let rec make_dir dir =
+  if not (Sys.file_exists dir) then begin
+    make_dir (Filename.dirname dir);
+    try Sys.mkdir dir 0o755 with Sys_error _ -> ()
+  end
+
+(** Writes the file [name] in the cache directory atomically, using [write]. Failures are ignored. *)
+let write_file name write =
+  match Lazy.force cache_dir with
+    None -> ()
+  | Some dir ->
+    try
+      make_dir dir;
+      let temp_path = Filename.temp_file ~temp_dir:dir "vfcache" ".tmp" in
+      begin try
+        let chan = open_out_bin temp_path in
+        Fun.protect ~finally:(fun () -> close_out_noerr chan) (fun () -> write chan);
+        Sys.rename temp_path (Filename.concat dir name)
+      with e ->
+        (try Sys.remove temp_path with Sys_error _ -> ());
+        raise e
+      end
+    with Sys_error _ -> ()
+
+(** Reads the file [name] in the cache directory using [read], if it exists. *)
+let read_file name read =
+  match Lazy.force cache_dir with
+    None -> None
+  | Some dir ->
+    try
+      let chan = open_in_bin (Filename.concat dir name) in
+      Fun.protect ~finally:(fun () -> close_in_noerr chan) (fun () -> read chan)
+    with Sys_error _ | End_of_file | Failure _ -> None
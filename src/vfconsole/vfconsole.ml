@@ -20,6 +20,10 @@ let rec json_of_loc l =
   | MacroExpansion (l1, l2) -> A [S "MacroExpansion"; json_of_loc l1; json_of_loc l2]
   | MacroParamExpansion (l1, l2) -> A [S "MacroParamExpansion"; json_of_loc l1; json_of_loc l2]
 
+(* Limits on the size of the symbolic execution trace reported by -json; see JsonOf.write_json_of_ctxts *)
+let json_max_heap_chunks = ref max_int
+let json_max_context_depth = ref max_int
+
 module JsonOf(ARGS: sig
   val string_of_type: type_ -> string
 end) = struct
@@ -42,6 +46,32 @@ end) = struct
     | PopSubcontext -> A [S "PopSubcontext"]
     | Branching b -> A [S "Branching"; S (match b with LeftBranch -> "LeftBranch" | RightBranch -> "RightBranch")]
 
+  (** Writes the context stack [ctxts] (most recent entry first) to [w], one heap chunk at a time, so that the full
+      trace is never held in memory as a JSON tree. Each heap is truncated to [!json_max_heap_chunks] chunks, followed by a
+      pseudo-chunk that reports the number of omitted chunks. Only the [!json_max_context_depth] most recent Executing
+      entries carry their heap and environment; older ones are written with an empty heap and environment, so that the
+      structure of the trace (and the source locations of its steps) is preserved. *)
+  let write_json_of_ctxts w ctxts =
+    begin_json_array w;
+    ctxts |> List.fold_left begin fun depth ctxt ->
+      match ctxt with
+        Executing (h, env, l, msg) ->
+        let (h, env) = if depth < !json_max_context_depth then (h, env) else ([], []) in
+        begin_json_array w;
+        write_json w (S "Executing");
+        write_json_array_truncated w !json_max_heap_chunks json_of_chunk
+          (fun omitted -> A [S ""; S (Printf.sprintf "... (%d more chunks)" omitted)]) h;
+        write_json w (json_of_env env);
+        write_json w (json_of_loc l);
+        write_json w (S msg);
+        end_json_array w;
+        depth + 1
+      | ctxt ->
+        write_json w (json_of_ctxt ctxt);
+        depth
+    end 0 |> ignore;
+    end_json_array w
+
 end
 
 module HashedLoc = struct
@@ -58,7 +88,78 @@ module HashedLine = struct
 end
 module LineHashtbl = Hashtbl.Make(HashedLine)
 
+(** Raised instead of exiting the process when a request of a verification
+    server (see [serve]) ends. *)
+exception RequestExit of int
+
+let in_server_child = ref false
+
+let exit code = if !in_server_child then raise (RequestExit code) else exit code
+
+(** Actions to perform when the files given on the command line have been
+    processed, such as writing the -stats_json output. A child process of a
+    verification server performs only the actions registered by its request. *)
+let request_exit_hooks: (unit -> unit) list ref = ref []
+let at_request_exit f = request_exit_hooks := f::!request_exit_hooks
+let run_request_exit_hooks () =
+  let hooks = !request_exit_hooks in
+  request_exit_hooks := [];
+  List.iter (fun f -> f ()) hooks
+let () = at_exit run_request_exit_hooks
+
+(** Reads verification requests from standard input, one per line, and handles
+    each one in a child process forked from the server process, so that the
+    child inherits the loaded prover and the checked prelude (see
+    [Verifast.verify_program]'s [prelude_hook]). A request is a tab-separated
+    list of a working directory followed by command-line arguments. After the
+    child's output, the server writes a line "verifast-server: exit N", where N
+    is the child's exit code. The child does not run the server's at_exit
+    handlers. *)
+let serve handle_request =
+  if Sys.os_type = "Win32" then begin
+    print_endline "The -server option is not supported on Windows.";
+    exit 2
+  end;
+  print_endline "verifast-server: ready";
+  let rec loop () =
+    match input_line stdin with
+      exception End_of_file -> ()
+    | "" -> loop ()
+    | line ->
+      let dir::args = String.split_on_char '\t' line in
+      flush stdout;
+      flush stderr;
+      let code =
+        match Unix.fork () with
+          0 ->
+          in_server_child := true;
+          request_exit_hooks := [];
+          let code =
+            try
+              Sys.chdir dir;
+              let code = try handle_request args; 0 with RequestExit code -> code in
+              run_request_exit_hooks ();
+              code
+            with
+              Arg.Bad msg | Arg.Help msg -> print_string msg; 2
+            | e -> print_endline ("Uncaught exception: " ^ Printexc.to_string e); 2
+          in
+          flush stdout;
+          flush stderr;
+          Unix._exit code
+        | pid ->
+          match Unix.waitpid [] pid with
+            (_, Unix.WEXITED code) -> code
+          | (_, (Unix.WSIGNALED _ | Unix.WSTOPPED _)) -> 255
+      in
+      Printf.printf "verifast-server: exit %d\n%!" code;
+      loop ()
+  in
+  loop ()
+
 let _ =
+  (* In a child process of a verification server: the server's prover, options and prelude verifier (see [serve]). *)
+  let warm_verifier = ref None in
   let verify ?(emitter_callback = fun _ _ _ -> ()) (print_stats : bool) (options : options) (prover : string) (path : string) (emitHighlightedSourceFiles : bool) (dumpPerLineStmtExecCounts : bool) allowDeadCode json expectedJsonResult applyQuickFix mergeOptionsFromSourceFile breakpoint focus targetPath =
     let exit l =
       Java_frontend_bridge.unload();
@@ -82,7 +183,7 @@ let _ =
               id
             | Some id -> id
           in
-          let Some forest = !forest in
+          match !forest with None -> Null | Some forest ->
           let buf = Buffer.create 10000 in
           let add_node_type = function
             ExecNode (msg, path) -> Printf.bprintf buf "#%d" (get_msg_id msg)
@@ -154,11 +255,16 @@ let _ =
         in
         reportUseSite, get_use_sites_json
     in
-    let exit_with_json_result resultJson =
+    (* [write_result] writes the result to the given JSON writer. *)
+    let exit_with_streamed_json_result write_result =
       match expectedJsonResult with
         Some path ->
         let expectedJson = readFile path in
-        let resultJsonString = string_of_json resultJson in
+        let resultJsonString =
+          let buf = Buffer.create 1024 in
+          write_result (json_writer_of_buffer buf);
+          Buffer.contents buf
+        in
         if resultJsonString = expectedJson then
           exit 0
         else begin
@@ -171,8 +277,23 @@ let _ =
       | None ->
         let majorVersion = 2 in
         let minorVersion = 0 in
-        print_json_endline (A [S "VeriFast-Json"; I majorVersion; I minorVersion; O ["result", resultJson; "useSites", get_use_sites_json (); "executionForest", get_execution_forest_json ()]])
+        let w = json_writer_of_channel stdout in
+        begin_json_array w;
+        write_json w (S "VeriFast-Json");
+        write_json w (I majorVersion);
+        write_json w (I minorVersion);
+        begin_json_object w;
+        write_json_key w "result";
+        write_result w;
+        write_json_key w "useSites";
+        write_json w (get_use_sites_json ());
+        write_json_key w "executionForest";
+        write_json w (get_execution_forest_json ());
+        end_json_object w;
+        end_json_array w;
+        print_newline ()
     in
+    let exit_with_json_result resultJson = exit_with_streamed_json_result (fun w -> write_json w resultJson) in
     let exit_with_msg l msg =
       if json then begin
         exit_with_json_result (A [S "StaticError"; json_of_loc l; S msg])
@@ -273,7 +394,34 @@ let _ =
         else
           prover, options
       in
-      let stats = verify_program ~emitter_callback:emitter_callback prover options path callbacks breakpoint focus targetPath in
+      let stats =
+        match !warm_verifier with
+          Some (prover', options', verify) when
+            prover' = prover && options' = options && file_specs path = (CLang, None) &&
+            breakpoint = None && focus = None && targetPath = None &&
+            (* The prelude's ranges and use sites were reported to the server's callbacks. *)
+            not json && not emitHighlightedSourceFiles ->
+          (* The verifier's prover context now holds this program's assumptions. *)
+          warm_verifier := None;
+          verify path callbacks emitter_callback
+        | _ ->
+          verify_program ~emitter_callback:emitter_callback prover options path callbacks breakpoint focus targetPath
+      in
+      begin match stats#functionsOverBudget with
+        [] -> ()
+      | functions ->
+        if print_stats then stats#printStats;
+        if json then
+          exit_with_json_result (A [S "BudgetExceeded"; stats#functionsOverBudgetJson])
+        else begin
+          functions |> List.iter begin fun (funName, budget, hottestLines) ->
+            Printf.printf "%s: %s exceeded\n" funName budget;
+            Printf.printf "  Hottest lines: %s\n" (String.concat ", " (List.map (fun (line, steps) -> Printf.sprintf "%s (%d steps)" line steps) hottestLines))
+          end;
+          Printf.printf "Verification budget exceeded by %d function(s); all other functions verified\n" (List.length functions)
+        end;
+        exit 1
+      end;
       reportDeadCode ();
       dumpPerLineStmtExecCounts ();
       if print_stats then stats#printStats;
@@ -336,7 +484,15 @@ let _ =
       let language, dialect = file_specs path in
       let open JsonOf(struct let string_of_type = string_of_type language dialect end) in
       if json then begin
-        exit_with_json_result (A [S "SymbolicExecutionError"; A (List.map json_of_ctxt ctxts); json_of_loc l; S msg; json_of_error_attributes url])
+        exit_with_streamed_json_result begin fun w ->
+          begin_json_array w;
+          write_json w (S "SymbolicExecutionError");
+          write_json_of_ctxts w ctxts;
+          write_json w (json_of_loc l);
+          write_json w (S msg);
+          write_json w (json_of_error_attributes url);
+          end_json_array w
+        end
       end else
         exit_with_msg l msg
     in
@@ -466,9 +622,15 @@ let _ =
   let dumpPerLineStmtExecCounts = ref false in
   let allowDeadCode = ref false in
   let allowIgnoreRefCreation = ref false in
+  let incremental = ref false in
+  let mergePaths = ref false in
+  let maxStepsPerFunction = ref None in
+  let maxProverSecondsPerFunction = ref None in
+  let server = ref false in
   let readOptionsFromSourceFile = ref false in
   let exports: string list ref = ref [] in
   let outputSExpressions : string option ref = ref None in
+  let binarySExpressions = ref false in
   let dumpAST: (bool * bool * string) option ref = ref None in
   let breakpoint: (string * int) option ref = ref None in
   let focus: (string * int) option ref  = ref None in
@@ -511,8 +673,11 @@ let _ =
    *)
   let cla = cla @
             [ "-stats", Set stats, " "
+            ; "-stats_allocations", Unit (fun () -> stats := true; Stats.report_allocations := true), "Like -stats, and also reports the number of words allocated, in total and per execution step."
             ; "-read_options_from_source_file", Set readOptionsFromSourceFile, "Retrieve disable_overflow_check, prover, target settings from first line of .c/.java file; syntax: //verifast_options{disable_overflow_check prover:z3v4.5 target:32bit}"
             ; "-json", Set json, "Report result as JSON"
+            ; "-json_max_heap_chunks", Set_int json_max_heap_chunks, "-json_max_heap_chunks N reports at most N chunks of each heap in the symbolic execution trace of a -json result."
+            ; "-json_max_context_depth", Set_int json_max_context_depth, "-json_max_context_depth N reports the heap and environment only for the N most recent steps of the symbolic execution trace of a -json result."
             ; "-expect_json_result", String (fun file -> json := true; expected_json_result_file := Some file), "Expect JSON result from file"
             ; "-apply_quick_fix", String (fun file -> apply_quick_fix := Some file), "Apply the quick fix proposed by VeriFast and write the resulting source file to the specified file"
             ; "-verbose", Set_int verbose, "-1 = file processing; 1 = statement executions; 2 = produce/consume steps; 4 = prover queries."
@@ -526,6 +691,17 @@ let _ =
             ; "-break_at_node", String (fun path -> targetPath := Some (path |> String.split_on_char ',' |> List.map int_of_string)), "Break when symbolic execution reaches the specified node in the execution tree."
             ; "-allow_should_fail", Set allowShouldFail, "Allow '//~' annotations that specify the line should fail."
             ; "-allow_ignore_ref_creation", Set allowIgnoreRefCreation, "Allow //~ignore_ref_creation directives."
+            ; "-incremental", Set incremental, "Skip functions whose body, contract and dependencies are unchanged since they last verified successfully; results are cached in a .vfcache file next to the source file."
+            ; "-audit_preprocessor", Set Lexer.audit_context_free_headers, "Check every header inclusion by running the normal preprocessor and the context-free preprocessor in lockstep, even if the header was found to be context-free before in a context that agrees on the header's dependencies."
+            ; "-rust_translation_jobs", Set_int Verifast0.rust_translation_jobs, "Translate the function bodies of a Rust program using the specified number of worker processes (ignored on Windows)."
+            ; "-stats_json", String (fun path -> at_request_exit (fun () -> let chan = open_out path in output_string chan (string_of_json (!Stats.stats)#json); close_out chan)), "-stats_json file writes the statistics (see -stats), including the prover's internal counters, GC statistics, and peak memory use, to the specified file as a JSON object."
+            ; "-profile", String (Profiler.start ~at_exit:at_request_exit), "-profile prefix writes, for each symbolic execution stack (function, then the current line at each call/lemma/predicate level), the wall time, Redux time, number of forks, and number of chunk matching attempts to prefix.wall.folded, prefix.prover.folded, prefix.branches.folded, and prefix.chunk_matches.folded, in the collapsed stack format of flame graph tools."
+            ; "-max_steps_per_function", Int (fun n -> maxStepsPerFunction := Some n), "-max_steps_per_function N stops verifying a function after N symbolic execution steps, reports it as having exceeded its budget, and continues with the next function."
+            ; "-max_prover_seconds_per_function", Float (fun s -> maxProverSecondsPerFunction := Some s), "-max_prover_seconds_per_function S stops verifying a function once it has spent S seconds in the prover (measured for the Redux prover only), reports it as having exceeded its budget, and continues with the next function."
+            ; "-merge_paths", Set mergePaths, "At the join point of an if statement whose branches only assign side-effect-free expressions over local variables to local variables, merge the two symbolic states using conditional terms instead of verifying the rest of the function once per branch."
+            ; "-no_exec_tree", Unit (fun () -> Verifast0.exec_tree_mode := NoExecTree), "Do not record the symbolic execution tree (which is otherwise kept in memory for -json output)."
+            ; "-exec_tree_trace", String (fun path -> Verifast0.exec_tree_mode := StreamExecTree (Exec_trace.create_writer (open_out_bin path))), "Write the symbolic execution tree to the specified file in a compact binary format, as it is generated, instead of keeping it in memory. The file can be opened using vfide -exec_tree_trace."
+            ; "-server", Set server, "Verify the files specified on standard input, one tab-separated line of working directory and command-line arguments per request, each in a child process that is forked after the prover has been loaded and the prelude has been parsed (not supported on Windows)."
             ; "-emit_vfmanifest", Set emitManifest, " "
             ; "-check_vfmanifest", Set checkManifest, " "
             ; "-emit_dll_vfmanifest", Set emitDllManifest, " "
@@ -549,6 +725,13 @@ let _ =
                 SExpressionEmitter.unsupported_exception := true
               end,
               "Emits the AST as an s-expression to the specified file; raises exception on unsupported constructs."
+            ; "-emit_sexpr_binary",
+              String begin fun str ->
+                outputSExpressions := Some str;
+                binarySExpressions := true;
+                SExpressionEmitter.unsupported_exception := false
+              end,
+              "Emits the AST as an s-expression to the specified file, in a compact binary format (see SExpressions.ml)."
             ; "-dump_ast", String (fun str -> dumpAST := Some (false, true, str)), "Dumps the verified module's AST to the specified file."
             ; "-dump_ast_with_locs", String (fun str -> dumpAST := Some (false, false, str)), "Dumps the verified module's AST, including source locations, to the specified file."
             ; "-dump_asts", String (fun str -> dumpAST := Some (true, true, str)), "Dumps the the verified module's AST as well as all header files' ASTs to the specified directory."
@@ -563,32 +746,39 @@ let _ =
             ; "-rustc_args", String (fun args -> vfbindings := Vfbindings.set Vfparam_rustc_args (List.rev (String.split_on_char ' ' args)) !vfbindings), "Add the given arguments to the rustc command line"
             ]
   in
+  let current_options () =
+    let vfbindings = !vfbindings in
+    let includePaths = Vfbindings.get Vfparam_include_paths vfbindings in
+    let includePaths = List.map (Util.replace_vroot !vroots) includePaths in
+    let vfbindings = Vfbindings.set Vfparam_include_paths includePaths vfbindings in
+    {
+      option_verbose = !verbose;
+      option_verbose_flags = !verbose_flags;
+      option_vfbindings = vfbindings;
+      option_allow_should_fail = !allowShouldFail;
+      option_allow_ignore_ref_creation = !allowIgnoreRefCreation;
+      option_incremental = !incremental;
+      option_merge_paths = !mergePaths;
+      option_max_steps_per_function = !maxStepsPerFunction;
+      option_max_prover_seconds_per_function = !maxProverSecondsPerFunction;
+      option_emit_manifest = !emitManifest;
+      option_check_manifest = !checkManifest;
+      option_vroots = !vroots;
+      option_allow_assume = !allowAssume;
+      option_provides = !provides;
+      option_keep_provide_files = !keepProvideFiles;
+      option_safe_mode = !safe_mode;
+      option_header_whitelist = !header_whitelist;
+      option_use_java_frontend = !useJavaFrontend;
+      option_enforce_annotations = !enforceAnnotations;
+      option_report_skipped_stmts = false;
+    }
+  in
   let process_file filename =
     if List.exists (Filename.check_suffix filename) [ ".c"; ".h"; ".cpp"; ".hpp"; ".java"; ".scala"; ".jarsrc"; ".javaspec"; ".rs" ]
     then
       begin
-        let vfbindings = !vfbindings in
-        let includePaths = Vfbindings.get Vfparam_include_paths vfbindings in
-        let includePaths = List.map (Util.replace_vroot !vroots) includePaths in
-        let vfbindings = Vfbindings.set Vfparam_include_paths includePaths vfbindings in
-        let options = {
-          option_verbose = !verbose;
-          option_verbose_flags = !verbose_flags;
-          option_vfbindings = vfbindings;
-          option_allow_should_fail = !allowShouldFail;
-          option_allow_ignore_ref_creation = !allowIgnoreRefCreation;
-          option_emit_manifest = !emitManifest;
-          option_check_manifest = !checkManifest;
-          option_vroots = !vroots;
-          option_allow_assume = !allowAssume;
-          option_provides = !provides;
-          option_keep_provide_files = !keepProvideFiles;
-          option_safe_mode = !safe_mode;
-          option_header_whitelist = !header_whitelist;
-          option_use_java_frontend = !useJavaFrontend;
-          option_enforce_annotations = !enforceAnnotations;
-          option_report_skipped_stmts = false;
-        } in
+        let options = current_options () in
         if not !json then print_endline filename;
         let emitter_callback (path : string) (dir : string) (packages : package list) =
           begin match !dumpAST with
@@ -605,7 +795,7 @@ let _ =
             match !outputSExpressions with
               | Some target_file ->
                 Printf.printf "Emitting s-expressions to %s\n" target_file;
-                SExpressionEmitter.emit target_file packages
+                SExpressionEmitter.emit ~binary:!binarySExpressions target_file packages
               | None             -> ()
         in
         verify ~emitter_callback:emitter_callback !stats options !prover filename !emitHighlightedSourceFiles !dumpPerLineStmtExecCounts !allowDeadCode !json !expected_json_result_file !apply_quick_fix !readOptionsFromSourceFile !breakpoint !focus !targetPath;
@@ -645,27 +835,50 @@ let _ =
       if !verbose = -1 then Printf.printf "%10.6fs: done with file %s\n\n" (Perf.time()) filename;
       result
     in
+    let link () =
+      if not !compileOnly && not !all_files_are_dotrs_files then
+        begin
+          try
+            print_endline "Linking...";
+            let library_paths = List.map (Util.replace_vroot !vroots) !library_paths in
+            let libs = [Filename.concat !Util.bindir "crt.dll.vfmanifest"] in
+            let assume_lib = Filename.concat !Util.bindir "assume.dll.vfmanifest" in
+            let libs = if !allowAssume then libs @ [assume_lib] else libs in
+            let allModules = libs @ List.rev !allModules in
+            if !verbose = -1 then Printf.printf "\n%10.6fs: linking files: %s\n\n" (Perf.time()) (String.concat " " allModules);
+            let dllManifest =
+              if !emitDllManifest then Some (!dllManifestName) else None
+            in
+            link_program !vroots library_paths (!isLibrary) allModules dllManifest !exports;
+            if (!linkShouldFail) then 
+              (print_endline "Error: link phase succeeded, while expected to fail (option -link_should_fail)."; exit 1)
+            else print_endline "Program linked successfully."
+          with
+              LinkError msg when (!linkShouldFail) -> print_endline msg; print_endline "Link phase failed as expected (option -link_should_fail)."
+            | LinkError msg -> print_endline msg; exit 1
+            | CompilationError msg -> print_endline ("error: " ^ msg); exit 1
+        end
+    in
     parse cla process_file usage_string;
-    if not !compileOnly && not !all_files_are_dotrs_files then
-      begin
-        try
-          print_endline "Linking...";
-          let library_paths = List.map (Util.replace_vroot !vroots) !library_paths in
-          let libs = [Filename.concat !Util.bindir "crt.dll.vfmanifest"] in
-          let assume_lib = Filename.concat !Util.bindir "assume.dll.vfmanifest" in
-          let libs = if !allowAssume then libs @ [assume_lib] else libs in
-          let allModules = libs @ List.rev !allModules in
-          if !verbose = -1 then Printf.printf "\n%10.6fs: linking files: %s\n\n" (Perf.time()) (String.concat " " allModules);
-          let dllManifest =
-            if !emitDllManifest then Some (!dllManifestName) else None
-          in
-          link_program !vroots library_paths (!isLibrary) allModules dllManifest !exports;
-          if (!linkShouldFail) then 
-            (print_endline "Error: link phase succeeded, while expected to fail (option -link_should_fail)."; exit 1)
-          else print_endline "Program linked successfully."
-        with
-            LinkError msg when (!linkShouldFail) -> print_endline msg; print_endline "Link phase failed as expected (option -link_should_fail)."
-          | LinkError msg -> print_endline msg; exit 1
-          | CompilationError msg -> print_endline ("error: " ^ msg); exit 1
+    if !server then begin
+      (* Check the prelude, then fork the children from within the prover context in which it was checked. *)
+      let prover = !prover in
+      let options = current_options () in
+      let serving = ref false in
+      let serve_requests verify =
+        serving := true;
+        warm_verifier := Some (prover, options, verify);
+        serve begin fun args ->
+          Arg.parse_argv ~current:(ref 0) (Array.of_list (Sys.executable_name::args)) cla process_file usage_string;
+          link ()
+        end
+      in
+      begin try
+        ignore (verify_program ~prelude_hook:serve_requests prover options (Filename.concat (Sys.getcwd ()) "vfserver.c") Verifast1.noop_callbacks None None None)
+      with e when not !serving ->
+        print_endline ("verifast-server: checking the prelude failed: " ^ Printexc.to_string e);
+        exit 1
       end
+    end else
+      link ()
   end
@@ -134,6 +134,8 @@ let define_macros: string list ref = ref []
 
 let () = Unix.putenv "LANG" "en_US" (* This works around a problem that causes vfide to become unusable in the Chinese locale. *)
 
+let () = persistent_rust_exporter := true (* Rust programs are typically re-verified many times in the IDE. *)
+
 let () =
   if platform = Linux && Sys.getenv_opt "VERIFAST_USE_PLATFORM_GTK_THEME" = None then
     Unix.putenv "GTK_DATA_PREFIX" "bogus dir" (* See https://github.com/verifast/verifast/issues/147 *)
@@ -257,7 +259,7 @@ end
 let is_real_path path =
   not (String.starts_with ~prefix:"/RUSTC_VIRTUAL_PATH" path)
 
-let show_ide initialPath prover codeFont traceFont vfbindings layout javaFrontend enforceAnnotations verifyAndQuit =
+let show_ide initialPath prover codeFont traceFont vfbindings layout javaFrontend enforceAnnotations verifyAndQuit execTreeTrace =
   let vfbindings = ref vfbindings in
   let set_or_reset_bool_vfbinding p b = vfbindings := Vfbindings.set_or_reset_bool p b !vfbindings in
   let leftBranchPixbuf = Branchleft_png.pixbuf () in
@@ -1699,6 +1701,10 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
                 option_enforce_annotations = enforceAnnotations;
                 option_allow_should_fail = true;
                 option_allow_ignore_ref_creation = true;
+                option_incremental = false;
+                option_merge_paths = false;
+                option_max_steps_per_function = None;
+                option_max_prover_seconds_per_function = None;
                 option_emit_manifest = false;
                 option_check_manifest = false;
                 option_vroots = [crt_vroot default_bindir];
@@ -2102,6 +2108,7 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
   end;
   root#show();
   ignore $. Glib.Idle.add (fun () -> textPaned#set_position 0; false);
+  execTreeTrace |> Option.iter (fun path -> reportExecutionForest (Exec_trace.read_file path));
   if verifyAndQuit then begin
     ignore $. Glib.Idle.add begin fun () ->
       verifyProgram false false None ();
@@ -2126,6 +2133,7 @@ let () =
   let enforceAnnotations = ref false in
   let vfbindings = ref Vfbindings.default in
   let verify_and_quit = ref false in
+  let exec_tree_trace = ref None in
   let rec iter args =
     match args with
       "-prover"::arg::args -> prover := arg; iter args
@@ -2137,6 +2145,7 @@ let () =
     | "-javac"::args -> javaFrontend := true; iter args
     | "-enforce_annotations"::args -> enforceAnnotations := true; iter args
     | "-verify_and_quit"::args -> verify_and_quit := true; iter args
+    | "-exec_tree_trace"::arg::args -> exec_tree_trace := Some arg; iter args
     | arg::args when startswith arg "-" && List.mem_assoc (String.sub arg 1 (String.length arg - 1)) vfparams ->
       let (Vfparam vfparam, _) = List.assoc (String.sub arg 1 (String.length arg - 1)) vfparams in
       begin match vfparam_info_of vfparam with
@@ -2153,7 +2162,7 @@ let () =
       vfbindings := Vfbindings.set Vfparam_rustc_args (List.rev (String.split_on_char ' ' arg)) !vfbindings;
       iter args
     | arg::args when not (startswith arg "-") -> path := Some arg; iter args
-    | [] -> show_ide !path !prover !codeFont !traceFont !vfbindings !layout !javaFrontend !enforceAnnotations !verify_and_quit
+    | [] -> show_ide !path !prover !codeFont !traceFont !vfbindings !layout !javaFrontend !enforceAnnotations !verify_and_quit !exec_tree_trace
     | _ ->
       let options = [
         "-prover prover    (" ^ list_provers () ^ ")";
@@ -2162,7 +2171,8 @@ let () =
         "-layout fourthree|widescreen";
         "-javac";
         "-bindir";
-        "-enforce_annotations"
+        "-enforce_annotations";
+        "-exec_tree_trace tracefile   Show the symbolic execution tree written by vfconsole -exec_tree_trace"
       ] @ List.map (fun (paramName, (_, description)) -> "-" ^ paramName ^ "   " ^ description) vfparams in
       GToolbox.message_box ~title:"VeriFast IDE" begin
         "Invalid command line.\n\n" ^ 
@@ -77,7 +77,15 @@ module Z3 = struct
 
 end
 
-class z3_context () =
+(* If [use_assumptions] is true, the context does not use Z3's push and pop. Instead, each push creates a fresh
+   Boolean indicator literal and the facts assumed until the matching pop are asserted as implications guarded by
+   it; queries check satisfiability under the indicator literals of the active frames, and a pop asserts the
+   negation of the frame's indicator literal. Definitional axioms (constructor tags, fixpoint clauses, inverse
+   functions) are asserted unguarded, once. This way, Z3's learned clauses survive across queries and pops.
+   The clauses of popped frames and finished queries stay in the solver, though, so once [dead_assertions_limit]
+   of them have piled up, the solver is reset at the next pop and the axioms and the live frames' facts are
+   asserted again. *)
+class z3_context ?(use_assumptions = false) () =
   let () = Z3native.global_param_set "smt.auto_config" "false" in
   let () = Z3native.global_param_set "smt.mbqi" "false" in
   let cfg = Z3native.mk_config () in
@@ -107,18 +115,62 @@ class z3_context () =
   let get_ctor_tag () = let k = !ctor_counter in ctor_counter := k + 1; k in
   let mk_unary_app f t = Z3.mk_app ctxt f [| t |] in
   let solver = Z3native.mk_simple_solver ctxt in
-  let assert_term t =
+  (* In assumption mode, the indicator literal of each active frame and the assertions made in it, most recent
+     first, innermost frame first. *)
+  let frames = ref [] in
+  (* In assumption mode, the assertions that are not guarded by any frame, most recent first. *)
+  let base_assertions = ref [] in
+  (* In assumption mode, the number of assertions in the solver that no longer affect any query. *)
+  let dead_assertions = ref 0 in
+  let dead_assertions_limit = 10000 in
+  let assert_axiom t =
     Z3native.solver_assert ctxt solver t;
-    match Z3enums.lbool_of_int (Z3native.solver_check ctxt solver) with
+    if use_assumptions then base_assertions := t::!base_assertions
+  in
+  let assert_in_frame t =
+    match !frames with
+      [] -> assert_axiom t
+    | (p, ts)::_ ->
+      let t = Z3native.mk_implies ctxt p t in
+      Z3native.solver_assert ctxt solver t;
+      ts := t::!ts
+  in
+  let reset_solver () =
+    Z3native.solver_reset ctxt solver;
+    List.iter (Z3native.solver_assert ctxt solver) (List.rev !base_assertions);
+    List.iter (fun (_, ts) -> List.iter (Z3native.solver_assert ctxt solver) (List.rev !ts)) (List.rev !frames);
+    dead_assertions := 0
+  in
+  let check assumptions =
+    let result =
+      if use_assumptions then
+        Z3native.solver_check_assumptions ctxt solver (List.length assumptions) assumptions
+      else
+        Z3native.solver_check ctxt solver
+    in
+    match Z3enums.lbool_of_int result with
       Z3enums.L_FALSE -> Unsat
     | Z3enums.L_UNDEF -> Unknown
     | Z3enums.L_TRUE -> Unknown
   in
+  let assert_term t =
+    assert_in_frame t;
+    check (List.map fst !frames)
+  in
   let query t =
-    Z3native.solver_push ctxt solver;
-    let result = assert_term (Z3native.mk_not ctxt t) = Unsat in
-    Z3native.solver_pop ctxt solver 1;
-    result
+    if use_assumptions then begin
+      let q = Z3native.mk_fresh_const ctxt "query" bool_type in
+      Z3native.solver_assert ctxt solver (Z3native.mk_implies ctxt q (Z3native.mk_not ctxt t));
+      let result = check (q::List.map fst !frames) = Unsat in
+      Z3native.solver_assert ctxt solver (Z3native.mk_not ctxt q);
+      dead_assertions := !dead_assertions + 2;
+      result
+    end else begin
+      Z3native.solver_push ctxt solver;
+      let result = assert_term (Z3native.mk_not ctxt t) = Unsat in
+      Z3native.solver_pop ctxt solver 1;
+      result
+    end
   in
   let assume_is_inverse f1 f2 dom2 =
     let name = Z3native.mk_int_symbol ctxt 0 in
@@ -126,7 +178,7 @@ class z3_context () =
     let app1 = Z3.mk_app ctxt f2 [| x |] in
     let app2 = Z3.mk_app ctxt f1 [| app1 |] in
     let pat = Z3.mk_pattern ctxt [| app1 |] in
-    Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] [| dom2 |] [| name |] (Z3native.mk_eq ctxt app2 x))
+    assert_axiom (Z3.mk_forall ctxt 0 [| pat |] [| dom2 |] [| name |] (Z3native.mk_eq ctxt app2 x))
   in
   let boxed_int = Z3.mk_func_decl ctxt (Z3native.mk_string_symbol ctxt "(intbox)") [| int_type |] inductive_type in
   let unboxed_int = Z3.mk_func_decl ctxt (Z3native.mk_string_symbol ctxt "(int)") [| inductive_type |] int_type in
@@ -165,14 +217,14 @@ class z3_context () =
             let xs = Array.init (Array.length tps) (fun j -> Z3native.mk_bound ctxt j tps.(j)) in
             let app = Z3.mk_app ctxt c xs in
             if domain = [] then
-              Z3native.solver_assert ctxt solver (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag)
+              assert_axiom (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag)
             else
             begin
               let names = Array.init (Array.length tps) (Z3native.mk_int_symbol ctxt) in
               let pat = Z3.mk_pattern ctxt [| app |] in
               (* disjointness axiom *)
               (* (forall (x1 ... xn) (PAT (C x1 ... xn)) (EQ (tag (C x1 ... xn)) Ctag)) *)
-              Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag));
+              assert_axiom (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag));
             end
           end;
           for i = 0 to Array.length tps - 1 do
@@ -183,7 +235,7 @@ class z3_context () =
             let pat = Z3.mk_pattern ctxt [| app |] in
             (* injectiveness axiom *)
             (* (forall (x1 ... x2) (PAT (C x1 ... xn)) (EQ (finv (C x1 ... xn)) xi)) *)
-            Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app finv app) (xs.(i))))
+            assert_axiom (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app finv app) (xs.(i))))
           done
         | Fixpoint (_, j) -> ()
         | Uninterp -> ()
@@ -208,10 +260,10 @@ class z3_context () =
            let pat = Z3.mk_pattern ctxt [| fapp |] in
            let body = fbody (Array.to_list fargs) (Array.to_list cargs) in
            if l = 0 then
-             Z3native.solver_assert ctxt solver (Z3native.mk_eq ctxt fapp body)
+             assert_axiom (Z3native.mk_eq ctxt fapp body)
            else
              (* (FORALL (x1 ... y1 ... ym ... xn) (PAT (f x1 ... (C y1 ... ym) ... xn)) (EQ (f x1 ... (C y1 ... ym) ... xn) body)) *)
-             Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt fapp body))
+             assert_axiom (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt fapp body))
         )
         cs
 
@@ -254,7 +306,7 @@ class z3_context () =
     method pprint_sort (s : Z3native.sort) = Z3native.ast_to_string ctxt s
     method pprint_sym (s : Z3native.func_decl) = Z3native.ast_to_string ctxt s
     method assert_term t =
-      Z3native.solver_assert ctxt solver t
+      assert_in_frame t
     method query t =
       (* printf "Z3prover.query (%s)... " (Z3native.ast_to_string ctxt t); *)
       let t0 = if verbosity >= 1 then Perf.time() else 0.0 in
@@ -270,19 +322,34 @@ class z3_context () =
     method push =
       if verbosity >= 10 then Printf.printf "Pushing from level %d to %d\n" pushlevel (pushlevel + 1);
       pushlevel <- pushlevel + 1;
-      Z3native.solver_push ctxt solver
+      if use_assumptions then
+        frames := (Z3native.mk_fresh_const ctxt "frame" bool_type, ref [])::!frames
+      else
+        Z3native.solver_push ctxt solver
     method pop =
       if verbosity >= 10 then Printf.printf "Popping from level %d to %d\n" pushlevel (pushlevel - 1);
       pushlevel <- pushlevel - 1;
-      Z3native.solver_pop ctxt solver 1
+      if use_assumptions then begin
+        match !frames with
+          [] -> failwith "Z3 context: pop without a matching push"
+        | (p, ts)::frames' ->
+          frames := frames';
+          dead_assertions := !dead_assertions + List.length !ts + 1;
+          if !dead_assertions >= dead_assertions_limit then
+            reset_solver ()
+          else
+            Z3native.solver_assert ctxt solver (Z3native.mk_not ctxt p)
+      end else
+        Z3native.solver_pop ctxt solver 1
     method perform_pending_splits (cont: Z3native.ast list -> bool) = cont []
     method stats: string * (string * int64) list = "(no statistics for Z3)", []
+    method counters: (string * int) list = []
     method begin_formal = ()
     method end_formal = ()
     method mk_bound (i: int) (tp: Z3native.sort) = Z3native.mk_bound ctxt i tp
     method assume_forall (description: string) (triggers: Z3native.ast list) (tps: Z3native.sort list) (body: Z3native.ast): unit = 
       if List.length tps = 0 then
-        Z3native.solver_assert ctxt solver body
+        assert_in_frame body
       else
         let pats = (
           match triggers with
@@ -291,6 +358,6 @@ class z3_context () =
         ) in
         let quant = (Z3.mk_forall ctxt 0 pats (Array.of_list tps) (Array.init (List.length tps) (Z3native.mk_int_symbol ctxt)) (body)) in
         (* printf "%s\n" (string_of_sexpr (simplify (parse_sexpr (Z3native.ast_to_string ctxt quant)))); *)
-        Z3native.solver_assert ctxt solver quant
+        assert_in_frame quant
    method simplify (t: Z3native.ast): Z3native.ast option = Some(Z3native.simplify ctxt t)
   end
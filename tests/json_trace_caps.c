@@ -0,0 +1,9 @@
+#include <stdlib.h>
+
+void leak()
+    //@ requires true;
+    //@ ensures true;
+{
+    int *p = malloc(sizeof(int));
+    if (p == 0) abort();
+}
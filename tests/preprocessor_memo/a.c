@@ -0,0 +1,9 @@
+#include "other.h"
+#include "shared.h"
+
+int a()
+    //@ requires true;
+    //@ ensures result == 1;
+{
+    return shared_value(1);
+}
@@ -0,0 +1,9 @@
+#define B_ONLY 1
+#include "shared.h"
+
+int b()
+    //@ requires true;
+    //@ ensures result == B_ONLY;
+{
+    return shared_value(B_ONLY);
+}
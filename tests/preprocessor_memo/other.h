@@ -0,0 +1,8 @@
+#ifndef OTHER_H
+#define OTHER_H
+
+int other_value();
+    //@ requires true;
+    //@ ensures true;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+int shared_value(int x);
+    //@ requires true;
+    //@ ensures result == x;
+
+#endif
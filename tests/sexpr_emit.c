@@ -0,0 +1,2 @@
+struct foo;
+struct bar;